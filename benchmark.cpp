@@ -0,0 +1,784 @@
+// compiled using g++ -O2 -o bench benchmark.cpp
+// usage: bench [list|bvh|bvh4|packed|all] [spheres|triangles] [objects] [rays] [arena|make_shared]
+//        bench order [scanline|morton|hilbert|all] [spheres|triangles] [objects] [tile]
+//        bench triangle [rays]
+//        bench texture [width] [lookups]
+//        bench sampling [samples]
+//        bench dynamic [largest scene] [frames] [moved per frame]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "utils1/functions.hpp"
+#include "utils1/vec3.hpp"
+#include "utils1/ray.hpp"
+#include "utils1/sphere.hpp"
+#include "utils1/triangle.hpp"
+#include "utils1/hittable.hpp"
+#include "utils1/hittable_list.hpp"
+#include "utils1/arena.hpp"
+#include "utils1/bvh.hpp"
+#include "utils1/wide_bvh.hpp"
+#include "utils1/packed_bvh.hpp"
+#include "utils1/camera.hpp"
+#include "utils1/material.hpp"
+#include "utils1/pixel_order.hpp"
+#include "utils1/mipmap.hpp"
+// same bvh as utils1, the dynamic scene only exists on the moving_around side
+#include "utils2/scene.hpp"
+
+using std::endl, std::cout, std::string;
+const double INF = std::numeric_limits<double>::infinity();
+
+struct bench_result {
+	double closest_ms;
+	double shadow_ms;
+	int hits;
+	int blocked;
+	double t_sum;
+};
+
+// hardware counter through perf_event_open, reports nothing where unsupported
+class cache_counter {
+	public:
+		cache_counter(uint32_t type, uint64_t config){
+#ifdef __linux__
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+		}
+
+		~cache_counter(){
+#ifdef __linux__
+			if(fd >= 0){
+				close(fd);
+			}
+#endif
+		}
+
+		bool available() const {return fd >= 0; }
+
+		void start(){
+#ifdef __linux__
+			if(fd >= 0){
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+
+		long long stop(){
+			long long value = -1;
+#ifdef __linux__
+			if(fd >= 0){
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+				if(read(fd, &value, sizeof(value)) != sizeof(value)){
+					value = -1;
+				}
+			}
+#endif
+			return value;
+		}
+
+	private:
+		int fd = -1;
+};
+
+// objects come from the arena when one is given, one make_shared each otherwise
+void build_scene(hittable_list &world, const string &kind, int count, scene_arena *arena = nullptr){
+	auto mat = arena ? arena->make<lambertian>(color(0.5, 0.5, 0.5)) : make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	world.objects.reserve(world.objects.size() + count);
+	for(int i=0; i<count; i++){
+		point3 c(random(-20, 20), random(0, 10), random(-40, 0));
+		if(kind == "triangles"){
+			vec3 a = 0.6 * random_unit_vector();
+			vec3 b = 0.6 * random_unit_vector();
+			world.add(arena ? arena->make<triangle>(c, c + a, c + b, mat) : make_shared<triangle>(c, c + a, c + b, mat));
+		}
+		else{
+			world.add(arena ? arena->make<sphere>(c, random(0.05, 0.4), mat) : make_shared<sphere>(c, random(0.05, 0.4), mat));
+		}
+	}
+}
+
+// half primary rays from a camera, half incoherent rays from random points in the scene
+std::vector<ray> build_rays(int count){
+	std::vector<ray> rays;
+	rays.reserve(count);
+	camera cam(60, 16.0 / 9.0, point3(0, 5, 8), point3(0, 5, 0), vec3(0, 1, 0));
+	int side = int(sqrt(count / 2.0)) + 1;
+	for(int i=0; i<count/2; i++){
+		rays.push_back(cam.get_ray(double(i % side) / side, double(i / side) / side));
+	}
+	while(int(rays.size()) < count){
+		point3 o(random(-20, 20), random(0, 10), random(-40, 0));
+		rays.push_back(ray(o, random_unit_vector()));
+	}
+	return rays;
+}
+
+bench_result run(const hittable &accel, const std::vector<ray> &rays){
+	bench_result res = {0, 0, 0, 0, 0};
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for(const ray &r : rays){
+		hit_record rec;
+		if(accel.intersect(r, 0.001, INF, rec)){
+			res.hits++;
+			res.t_sum += rec.t;
+		}
+	}
+	auto mid = std::chrono::high_resolution_clock::now();
+	for(const ray &r : rays){
+		if(accel.occluded(r, 0.001, 10.0)){
+			res.blocked++;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	res.closest_ms = std::chrono::duration<double, std::milli>(mid - start).count();
+	res.shadow_ms = std::chrono::duration<double, std::milli>(end - mid).count();
+	return res;
+}
+
+void report(const string &name, const bench_result &res, int rays){
+	cout << std::left << std::setw(6) << name << std::right << std::fixed << std::setprecision(2)
+		 << std::setw(10) << res.closest_ms << " ms" << std::setw(8) << rays / res.closest_ms / 1000 << " Mray/s closest"
+		 << std::setw(10) << res.shadow_ms << " ms" << std::setw(8) << rays / res.shadow_ms / 1000 << " Mray/s shadow"
+		 << "   hits " << res.hits << " blocked " << res.blocked << " t_sum " << std::setprecision(4) << res.t_sum << endl;
+}
+
+// primary ray and a shadow ray per pixel, in the given pixel order
+void run_order(const hittable &accel, const string &name, const std::vector<pixel_pos> &order, int width, int height){
+	camera cam(60, double(width) / height, point3(0, 5, 8), point3(0, 5, -10), vec3(0, 1, 0));
+	point3 light(0, 30, -20);
+#ifdef __linux__
+	cache_counter l1_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	cache_counter llc_misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+	cache_counter l1_misses(0, 0);
+	cache_counter llc_misses(0, 0);
+#endif
+
+	int hits = 0;
+	l1_misses.start();
+	llc_misses.start();
+	auto start = std::chrono::high_resolution_clock::now();
+	for(const pixel_pos &px : order){
+		ray r = cam.get_ray((px.x + 0.5) / width, (height - 1 - px.y + 0.5) / height);
+		hit_record rec;
+		if(accel.intersect(r, 0.001, INF, rec)){
+			// intersect() leaves p to finalize(), only t is known here
+			point3 p = r.at(rec.t);
+			if(!accel.occluded(ray(p, light - p), 0.001, 1.0)){
+				hits++;
+			}
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	long long l1 = l1_misses.stop();
+	long long llc = llc_misses.stop();
+
+	cout << std::left << std::setw(9) << name << std::right << std::fixed << std::setprecision(2)
+		 << std::setw(10) << std::chrono::duration<double, std::milli>(end - start).count() << " ms";
+	if(l1 >= 0){
+		cout << "   L1D read misses " << std::setw(12) << l1;
+	}
+	if(llc >= 0){
+		cout << "   cache misses " << std::setw(12) << llc;
+	}
+	if(l1 < 0 && llc < 0){
+		cout << "   (cache counters unavailable)";
+	}
+	cout << "   lit " << hits << endl;
+}
+
+int order_main(int argc, char *argv[]){
+	// VARIABLES
+	string curve_name = argc > 2 ? argv[2] : "all";
+	string scene_kind = argc > 3 ? argv[3] : "spheres";
+	int object_count = argc > 4 ? atoi(argv[4]) : 200000;
+	int tile = argc > 5 ? atoi(argv[5]) : 16;
+	const int WIDTH = 720;
+	const int HEIGHT = 405;
+
+	// DEFINE WORLD
+	hittable_list world;
+	build_scene(world, scene_kind, object_count);
+	bvh accel(world.objects);
+	cout << object_count << " " << scene_kind << ", " << WIDTH << "x" << HEIGHT << ", tile " << tile << endl;
+
+	// RUN
+	for(string name : {"scanline", "morton", "hilbert"}){
+		if(curve_name == name || curve_name == "all"){
+			run_order(accel, name, pixel_order(WIDTH, HEIGHT, name == "scanline" ? 0 : tile, parse_pixel_curve(name)), WIDTH, HEIGHT);
+		}
+	}
+
+	return 0;
+}
+
+// the room commented out in render_scene.cpp split into triangles, walls and ceiling light
+std::vector<triangle> build_room(){
+	auto mat = make_shared<lambertian>(color(0.8, 0.8, 0.8));
+	point3 v[][3] = {
+		{point3(-3,0,0), point3(3,0,0), point3(3,0,-3)}, {point3(-3,0,-3), point3(-3,0,0), point3(3,0,-3)},
+		{point3(-3,0,0), point3(-3,5,0), point3(-3,0,-3)}, {point3(-3,5,-3), point3(-3,5,0), point3(-3,0,-3)},
+		{point3(3,0,0), point3(3,5,0), point3(3,0,-3)}, {point3(3,5,-3), point3(3,5,0), point3(3,0,-3)},
+		{point3(-3,0,-3), point3(3,0,-3), point3(3,5,-3)}, {point3(3,5,-3), point3(-3,5,-3), point3(-3,0,-3)},
+		{point3(-3,5,0), point3(3,5,0), point3(3,5,-3)}, {point3(-3,5,-3), point3(-3,5,0), point3(3,5,-3)},
+		{point3(-1,4.99,-1), point3(1,4.99,-1), point3(1,4.99,-2)}, {point3(-1,4.99,-2), point3(-1,4.99,-1), point3(1,4.99,-2)}
+	};
+	std::vector<triangle> room;
+	for(auto &t : v){
+		room.push_back(triangle(t[0], t[1], t[2], mat));
+	}
+	return room;
+}
+
+// the test triangle::intersect used before the edge-based kernel: plane first, then
+// the point against every edge; kept here as the baseline
+bool legacy_triangle_hit(const triangle &tri, const ray& r, double t_min, double t_max, double &t){
+	t = dot(tri.p0 - r.origin(), tri.normal) / dot(tri.normal, r.direction());
+	if(!(t > t_min && t_max > t)){
+		return false;
+	}
+	point3 intersection = r.at(t);
+	point3 p1 = tri.p0 + tri.e1, p2 = tri.p0 + tri.e2;
+	return dot(tri.normal, cross(intersection - tri.p0, p1 - tri.p0)) <= 0
+		&& dot(tri.normal, cross(intersection - p1, p2 - p1)) <= 0
+		&& dot(tri.normal, cross(intersection - p2, tri.p0 - p2)) <= 0;
+}
+
+// closest hit over the whole room per ray, with each kernel: the legacy test, Moller-Trumbore
+// on edges (packed records), the precomputed plane test of triangle, and four triangles per SSE call
+template<typename F>
+void run_triangles(const string &name, const std::vector<ray> &rays, F closest){
+	int hits = 0;
+	double t_sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for(const ray &r : rays){
+		double t = INF;
+		if(closest(r, t)){
+			hits++;
+			t_sum += t;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(end - start).count();
+	cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+		 << std::setw(10) << ms << " ms" << std::setw(8) << rays.size() / ms / 1000 << " Mray/s"
+		 << "   hits " << hits << " t_sum " << std::setprecision(4) << t_sum << endl;
+}
+
+int triangle_main(int argc, char *argv[]){
+	// VARIABLES
+	int ray_count = argc > 2 ? atoi(argv[2]) : 2000000;
+
+	// DEFINE WORLD
+	std::vector<triangle> room = build_room();
+	std::vector<triangle4> packets;
+	for(const triangle &t : room){
+		if(packets.empty() || !packets.back().add(t.p0, t.e1, t.e2)){
+			packets.push_back(triangle4());
+			packets.back().add(t.p0, t.e1, t.e2);
+		}
+	}
+
+	// rays from the render_scene camera into the open front and from inside the room
+	std::vector<ray> rays;
+	rays.reserve(ray_count);
+	camera cam(60, 16.0 / 9.0, point3(0, 2, 3), point3(0, 2, 0), vec3(0, 1, 0));
+	int side = int(sqrt(ray_count / 2.0)) + 1;
+	for(int i=0; i<ray_count/2; i++){
+		rays.push_back(cam.get_ray(double(i % side) / side, double(i / side) / side));
+	}
+	while(int(rays.size()) < ray_count){
+		point3 o(random(-2.9, 2.9), random(0.1, 4.9), random(-2.9, -0.1));
+		rays.push_back(ray(o, random_unit_vector()));
+	}
+	cout << room.size() << " room triangles, " << ray_count << " rays" << endl;
+
+	// RUN
+	run_triangles("legacy", rays, [&](const ray &r, double &closest){
+		bool hit = false;
+		for(const triangle &tri : room){
+			double t;
+			if(legacy_triangle_hit(tri, r, 0.001, closest, t)){
+				hit = true;
+				closest = t;
+			}
+		}
+		return hit;
+	});
+	run_triangles("mt", rays, [&](const ray &r, double &closest){
+		bool hit = false;
+		for(const triangle &tri : room){
+			double t, u, v;
+			if(intersect_triangle(r, tri.p0, tri.e1, tri.e2, 0.001, closest, t, u, v)){
+				hit = true;
+				closest = t;
+			}
+		}
+		return hit;
+	});
+	run_triangles("plane", rays, [&](const ray &r, double &closest){
+		bool hit = false;
+		for(const triangle &tri : room){
+			double t, u, v;
+			if(intersect_triangle_plane(r, tri.p0, tri.normal, tri.u_axis, tri.v_axis, 0.001, closest, t, u, v)){
+				hit = true;
+				closest = t;
+			}
+		}
+		return hit;
+	});
+	run_triangles("mt4", rays, [&](const ray &r, double &closest){
+		bool hit = false;
+		for(const triangle4 &packet : packets){
+			double t, u, v;
+			if(intersect_triangle4(packet, r, 0.001, closest, t, u, v) >= 0){
+				hit = true;
+				closest = t;
+			}
+		}
+		return hit;
+	});
+
+	return 0;
+}
+
+// scattered lookups into a width x width/2 texture, as secondary rays hit the skybox:
+// nearest texels of a row-major image, nearest texels of the tiled level 0, and the
+// mip chain with the footprint a ray gets after a diffuse bounce
+template<typename F>
+void run_lookups(const string &name, const std::vector<std::pair<double, double>> &uvs, F lookup){
+#ifdef __linux__
+	cache_counter l1_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	cache_counter llc_misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+	cache_counter l1_misses(0, 0);
+	cache_counter llc_misses(0, 0);
+#endif
+
+	double sum = 0;
+	l1_misses.start();
+	llc_misses.start();
+	auto start = std::chrono::high_resolution_clock::now();
+	for(const auto &uv : uvs){
+		color c = lookup(uv.first, uv.second);
+		sum += c.x() + c.y() + c.z();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	long long l1 = l1_misses.stop();
+	long long llc = llc_misses.stop();
+
+	double ms = std::chrono::duration<double, std::milli>(end - start).count();
+	cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+		 << std::setw(10) << ms << " ms" << std::setw(8) << uvs.size() / ms / 1000 << " M/s";
+	if(l1 >= 0){
+		cout << "   L1D read misses " << std::setw(12) << l1;
+	}
+	if(llc >= 0){
+		cout << "   cache misses " << std::setw(12) << llc;
+	}
+	cout << "   mean " << std::setprecision(4) << sum / (3.0 * uvs.size()) << endl;
+}
+
+int texture_main(int argc, char *argv[]){
+	// VARIABLES
+	int width = argc > 2 ? atoi(argv[2]) : 8192;
+	int lookup_count = argc > 3 ? atoi(argv[3]) : 4000000;
+	int height = width / 2;
+	// DIFFUSE_SPREAD of skybox.hpp, which needs SDL
+	const double spread = 0.2;
+
+	// DEFINE TEXTURE
+	std::vector<uint32_t> rows(size_t(width) * height);
+	for(size_t k=0; k<rows.size(); k++){
+		rows[k] = pack_texel(int(random_double() * 256), int(random_double() * 256), int(random_double() * 256));
+	}
+	mip_texture tex(rows.data(), width, height);
+	std::vector<std::pair<double, double>> uvs(lookup_count);
+	for(auto &uv : uvs){
+		uv = {random_double(), random_double()};
+	}
+	cout << width << "x" << height << " texture, " << rows.size() * sizeof(uint32_t) / 1048576 << " MB rows, "
+		 << tex.memory() / 1048576 << " MB mip chain, " << lookup_count << " lookups" << endl;
+
+	// RUN
+	run_lookups("rows", uvs, [&](double u, double v){
+		int x = std::min(int(u * width), width - 1);
+		int y = std::min(int(v * height), height - 1);
+		return unpack_texel(rows[size_t(y) * width + x]);
+	});
+	run_lookups("tiled", uvs, [&](double u, double v){
+		return tex.nearest(u, v, 0);
+	});
+	run_lookups("mip", uvs, [&](double u, double v){
+		return tex.sample(u, v, spread * width / (2 * M_PI));
+	});
+
+	return 0;
+}
+
+// SAMPLING CHECK
+// the closed-form warps of vec3.hpp against the rejection samplers they replaced,
+// as a two-sample chi-square over equal-probability bins plus a few moments.
+// Fails when a statistic is beyond the 0.1% critical value. Draws come from a
+// Mersenne Twister: rand() behind random_double is a lagged Fibonacci generator,
+// and the draws that rejection loops consume in threes are visibly correlated
+
+std::mt19937_64 check_engine(125);
+
+double check_double(){
+	return std::uniform_real_distribution<double>(0, 1)(check_engine);
+}
+
+// rejection sampling of the unit ball, as random_in_unit_sphere did before the warps
+vec3 rejection_in_unit_sphere(){
+	while(true){
+		auto p = vec3(2*check_double() - 1, 2*check_double() - 1, 2*check_double() - 1);
+		if(p.length_squared() <= 1){
+			return p;
+		}
+	}
+}
+
+// GGX normals by rejection against D(m)*cos(m), whose peak is 1/(pi*alpha^2) at the pole
+vec3 rejection_ggx_normal(double alpha){
+	while(true){
+		vec3 m = sample_hemisphere(check_double(), check_double());
+		if(check_double() * (1 / (M_PI * alpha*alpha)) <= ggx_d(alpha, m.z()) * m.z()){
+			return m;
+		}
+	}
+}
+
+// bin of a direction: a coordinate that is uniform under the expected distribution, times the angle
+int direction_bin(double uniform, const vec3 &d, int bins){
+	int a = std::clamp(int(uniform * bins), 0, bins - 1);
+	int b = std::clamp(int((atan2(d.y(), d.x()) / (2*M_PI) + 0.5) * bins), 0, bins - 1);
+	return a * bins + b;
+}
+
+// sum of (a-b)^2/(a+b) for equal totals, against the 0.1% critical value of
+// chi-square with as many degrees of freedom (Wilson-Hilferty)
+bool chi_square(const string &name, const std::vector<long long> &a, const std::vector<long long> &b){
+	double stat = 0;
+	int used = 0;
+	for(size_t k=0; k<a.size(); k++){
+		if(a[k] + b[k] > 0){
+			stat += double(a[k] - b[k]) * double(a[k] - b[k]) / double(a[k] + b[k]);
+			used++;
+		}
+	}
+	double dof = used - 1;
+	double h = 2 / (9 * dof);
+	double critical = dof * pow(1 - h + 3.09 * sqrt(h), 3);
+	bool ok = stat <= critical;
+	cout << std::left << std::setw(28) << name << std::right << " chi2 " << std::setw(9) << std::fixed << std::setprecision(1) << stat
+		 << " / " << std::setw(7) << critical << " (" << int(dof) << " dof)   " << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
+
+bool moment(const string &name, double warped, double reference, double expected, double tolerance){
+	bool ok = fabs(warped - expected) <= tolerance && fabs(reference - expected) <= tolerance;
+	cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(5) << " warp " << warped
+		 << "   rejection " << reference << "   expected " << expected << "   " << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
+
+int sampling_main(int argc, char *argv[]){
+	// VARIABLES
+	int n = argc > 2 ? atoi(argv[2]) : 1000000;
+	const int bins = 16;
+	const double alpha = 0.3;
+	// a few standard errors of a mean of n samples of a quantity in [0, 1]
+	const double tolerance = 5 / sqrt(double(n));
+	bool ok = true;
+	cout << n << " samples per distribution" << endl;
+
+	// UNIT BALL: cube of the radius, z and angle are uniform
+	{
+		std::vector<long long> a(bins * bins * bins), b(a.size());
+		double r_warp = 0, r_ref = 0;
+		auto bin = [&](const vec3 &p){
+			double r = p.length();
+			vec3 d = r > 0 ? p / r : vec3(0, 0, 1);
+			return std::clamp(int(r*r*r * bins), 0, bins - 1) * bins * bins + direction_bin((d.z() + 1) / 2, d, bins);
+		};
+		for(int i=0; i<n; i++){
+			vec3 p = sample_in_unit_sphere(check_double(), check_double(), check_double());
+			vec3 q = rejection_in_unit_sphere();
+			a[bin(p)]++;
+			b[bin(q)]++;
+			r_warp += p.length();
+			r_ref += q.length();
+		}
+		ok &= chi_square("in unit sphere", a, b);
+		ok &= moment("  mean radius", r_warp / n, r_ref / n, 0.75, tolerance);
+	}
+
+	// UNIT VECTORS, the scalar warp and the batch one against normalised rejection samples
+	{
+		std::vector<double> u1(n), u2(n), x(n), y(n), z(n);
+		for(int i=0; i<n; i++){
+			u1[i] = check_double();
+			u2[i] = check_double();
+		}
+		sample_unit_vector_batch(u1.data(), u2.data(), x.data(), y.data(), z.data(), n);
+
+		std::vector<long long> a(bins * bins), batch(a.size()), b(a.size());
+		double z2_warp = 0, z2_ref = 0;
+		int differ = 0;
+		for(int i=0; i<n; i++){
+			vec3 d = sample_unit_vector(u1[i], u2[i]);
+			vec3 e(x[i], y[i], z[i]);
+			vec3 q = normalised(rejection_in_unit_sphere());
+			differ += (d - e).length() > 1e-12;
+			a[direction_bin((d.z() + 1) / 2, d, bins)]++;
+			batch[direction_bin((e.z() + 1) / 2, e, bins)]++;
+			b[direction_bin((q.z() + 1) / 2, q, bins)]++;
+			z2_warp += d.z() * d.z();
+			z2_ref += q.z() * q.z();
+		}
+		ok &= chi_square("unit vector", a, b);
+		ok &= chi_square("unit vector batch", batch, b);
+		ok &= moment("  mean z^2", z2_warp / n, z2_ref / n, 1.0 / 3, tolerance);
+		cout << "  batch differs from scalar in " << differ << " samples" << endl;
+		ok &= differ == 0;
+	}
+
+	// COSINE HEMISPHERE against the old lambertian direction, normal plus a unit vector;
+	// z^2 is uniform under the cosine lobe
+	{
+		std::vector<double> u1(n), u2(n), x(n), y(n), z(n);
+		for(int i=0; i<n; i++){
+			u1[i] = check_double();
+			u2[i] = check_double();
+		}
+		sample_cosine_hemisphere_batch(u1.data(), u2.data(), x.data(), y.data(), z.data(), n);
+
+		std::vector<long long> a(bins * bins), batch(a.size()), b(a.size());
+		double z_warp = 0, z_ref = 0;
+		int differ = 0;
+		for(int i=0; i<n; i++){
+			vec3 d = sample_cosine_hemisphere(u1[i], u2[i]);
+			vec3 e(x[i], y[i], z[i]);
+			vec3 q;
+			do{
+				q = vec3(0, 0, 1) + normalised(rejection_in_unit_sphere());
+			}while(q.near_zero());
+			q = unit_vector(q);
+			differ += (d - e).length() > 1e-12;
+			a[direction_bin(d.z() * d.z(), d, bins)]++;
+			batch[direction_bin(e.z() * e.z(), e, bins)]++;
+			b[direction_bin(q.z() * q.z(), q, bins)]++;
+			z_warp += d.z();
+			z_ref += q.z();
+		}
+		ok &= chi_square("cosine hemisphere", a, b);
+		ok &= chi_square("cosine hemisphere batch", batch, b);
+		ok &= moment("  mean cos", z_warp / n, z_ref / n, 2.0 / 3, tolerance);
+		cout << "  batch differs from scalar in " << differ << " samples" << endl;
+		ok &= differ == 0;
+	}
+
+	// GGX NORMALS against rejection from D(m)*cos(m); tan^2/(alpha^2 + tan^2) is uniform
+	{
+		std::vector<long long> a(bins * bins), b(a.size());
+		double c_warp = 0, c_ref = 0;
+		auto uniform = [&](const vec3 &m){
+			double t2 = (1 - m.z() * m.z()) / (m.z() * m.z());
+			return t2 / (alpha*alpha + t2);
+		};
+		for(int i=0; i<n; i++){
+			vec3 m = sample_ggx_normal(alpha, check_double(), check_double());
+			vec3 q = rejection_ggx_normal(alpha);
+			a[direction_bin(uniform(m), m, bins)]++;
+			b[direction_bin(uniform(q), q, bins)]++;
+			c_warp += m.z();
+			c_ref += q.z();
+		}
+		ok &= chi_square("ggx normal, alpha 0.3", a, b);
+		cout << std::left << std::setw(28) << "  mean cos" << std::right << std::fixed << std::setprecision(5)
+			 << " warp " << c_warp / n << "   rejection " << c_ref / n << endl;
+		ok &= fabs(c_warp - c_ref) / n <= tolerance;
+	}
+
+	// GGX WEIGHTS: metal's scatter weights average to the directional albedo, which a
+	// uniform hemisphere estimate of the integral of eval * cos gives as well
+	{
+		metal m(color(1, 1, 1), alpha);
+		hit_record rec;
+		rec.p = point3(0, 0, 0);
+		rec.normal = vec3(0, 0, 1);
+		rec.front_face = true;
+		rec.u = rec.v = 0;
+		ray r_in(point3(-0.5, 0, 1), vec3(0.5, 0, -1));
+		double sampled = 0, uniform = 0;
+		for(int i=0; i<n; i++){
+			color attenuation;
+			ray scattered;
+			if(m.scatter(r_in, rec, vec3(check_double(), check_double(), check_double()), attenuation, scattered)){
+				sampled += attenuation.x();
+			}
+			vec3 dir = sample_hemisphere(check_double(), check_double());
+			// eval is f * cos already
+			uniform += m.eval(r_in, rec, dir).x() * 2 * M_PI;
+		}
+		// the uniform estimate has a much larger variance, so its tolerance is wider
+		bool agree = fabs(sampled - uniform) / n <= 4 * tolerance;
+		cout << std::left << std::setw(28) << "ggx albedo, 30 degrees" << std::right << std::fixed << std::setprecision(5)
+			 << " sampled " << sampled / n << "   uniform " << uniform / n << "   " << (agree ? "ok" : "FAILED") << endl;
+		ok &= agree;
+	}
+
+	cout << (ok ? "all distributions agree" : "some distributions differ") << endl;
+	return ok ? 0 : 1;
+}
+
+// per-frame cost of scene::commit as the scene grows, with a fixed number of
+// objects moved per frame: it should stay flat while the walk over all nodes grows
+int dynamic_main(int argc, char *argv[]){
+	// VARIABLES
+	int largest = argc > 2 ? atoi(argv[2]) : 100000;
+	int frames = argc > 3 ? atoi(argv[3]) : 200;
+	int moved = argc > 4 ? atoi(argv[4]) : 64;
+	bool ok = true;
+
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	for(int count = std::max(1, largest / 100); count <= largest; count *= 10){
+		scene world;
+		std::vector<int> ids;
+		for(int i=0; i<count; i++){
+			point3 c(random(-20, 20), random(0, 10), random(-40, 0));
+			ids.push_back(world.add(make_shared<sphere>(c, 0.1, mat)));
+		}
+		world.build();
+
+		double commit_ms = 0, commit_max = 0, walk_ms = 0, drift = 0;
+		for(int f=0; f<frames; f++){
+			for(int k=0; k<moved; k++){
+				world.move(ids[int(random_double() * count)], 0.5 * random_unit_vector());
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			world.commit();
+			auto mid = std::chrono::high_resolution_clock::now();
+			double walked = world.tree.sah_cost_walk();
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(mid - start).count();
+			commit_ms += ms;
+			commit_max = std::max(commit_max, ms);
+			walk_ms += std::chrono::duration<double, std::milli>(end - mid).count();
+			drift = std::max(drift, fabs(world.tree.sah_cost() - walked) / walked);
+		}
+		// let a rebuild still running finish before the scene goes away
+		while(world.rebuilding()){
+			world.commit();
+		}
+
+		// the running sum must match the walk, up to rounding
+		bool agree = drift < 1e-9;
+		ok &= agree;
+		cout << std::setw(8) << count << " objects   commit " << std::fixed << std::setprecision(4) << std::setw(9) << commit_ms / frames
+			 << " ms/frame (max " << std::setw(8) << commit_max << ")   full walk " << std::setw(8) << walk_ms / frames
+			 << " ms   quality " << std::setprecision(3) << world.quality() << "   drift " << std::scientific << std::setprecision(1)
+			 << drift << std::defaultfloat << "   " << (agree ? "ok" : "FAILED") << endl;
+	}
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]){
+	set_seed(125);
+	if(argc > 1 && string(argv[1]) == "order"){
+		return order_main(argc, argv);
+	}
+	if(argc > 1 && string(argv[1]) == "triangle"){
+		return triangle_main(argc, argv);
+	}
+	if(argc > 1 && string(argv[1]) == "texture"){
+		return texture_main(argc, argv);
+	}
+	if(argc > 1 && string(argv[1]) == "sampling"){
+		return sampling_main(argc, argv);
+	}
+	if(argc > 1 && string(argv[1]) == "dynamic"){
+		return dynamic_main(argc, argv);
+	}
+
+	// VARIABLES
+	string accel_name = argc > 1 ? argv[1] : "all";
+	string scene_kind = argc > 2 ? argv[2] : "spheres";
+	int object_count = argc > 3 ? atoi(argv[3]) : 10000;
+	int ray_count = argc > 4 ? atoi(argv[4]) : 500000;
+	string allocator = argc > 5 ? argv[5] : "arena";
+
+	// DEFINE WORLD
+	scene_arena arena;
+	hittable_list world;
+	auto scene_start = std::chrono::high_resolution_clock::now();
+	build_scene(world, scene_kind, object_count, allocator == "arena" ? &arena : nullptr);
+	auto scene_end = std::chrono::high_resolution_clock::now();
+	std::vector<ray> rays = build_rays(ray_count);
+
+	// ACCELERATION STRUCTURES
+	auto build_start = std::chrono::high_resolution_clock::now();
+	bvh binary(world.objects);
+	auto build_mid = std::chrono::high_resolution_clock::now();
+	wide_bvh wide(binary);
+	auto build_end = std::chrono::high_resolution_clock::now();
+	packed_bvh packed(world.objects);
+	auto pack_end = std::chrono::high_resolution_clock::now();
+
+	cout << object_count << " " << scene_kind << ", " << ray_count << " rays" << endl;
+	cout << "scene (" << allocator << ") " << std::chrono::duration<double, std::milli>(scene_end - scene_start).count() << " ms" << endl;
+	cout << "bvh build " << std::chrono::duration<double, std::milli>(build_mid - build_start).count() << " ms, "
+		 << binary.nodes.size() << " nodes of " << sizeof(bvh_node) << " bytes" << endl;
+	cout << "bvh4 collapse " << std::chrono::duration<double, std::milli>(build_end - build_mid).count() << " ms, "
+		 << wide.nodes.size() << " nodes of " << sizeof(bvh4_node) << " bytes" << endl;
+	cout << "packed build " << std::chrono::duration<double, std::milli>(pack_end - build_end).count() << " ms, "
+		 << packed.memory() / 1024 << " KiB" << endl;
+	// a pointer in the object list plus the object, its material pointer included
+	size_t object_bytes = scene_kind == "triangles" ? sizeof(triangle) : sizeof(sphere);
+	size_t record_bytes = scene_kind == "triangles" ? sizeof(triangle_record) : sizeof(sphere_record);
+	cout << "per primitive " << sizeof(shared_ptr<hittable>) + object_bytes << " bytes as objects, "
+		 << record_bytes << " bytes as records" << endl;
+	// what the tree costs on top: a binary node per child box tested, a bvh4 node per four
+	cout << "per primitive with nodes " << (binary.nodes.size() * sizeof(bvh_node)) / object_count + sizeof(shared_ptr<hittable>) + object_bytes
+		 << " bytes for bvh, " << packed.memory() / object_count << " bytes for packed" << endl;
+
+	// RUN
+	if(accel_name == "list" || (accel_name == "all" && object_count <= 2000)){
+		report("list", run(world, rays), ray_count);
+	}
+	if(accel_name == "bvh" || accel_name == "all"){
+		report("bvh", run(binary, rays), ray_count);
+	}
+	if(accel_name == "bvh4" || accel_name == "all"){
+		report("bvh4", run(wide, rays), ray_count);
+	}
+	if(accel_name == "packed" || accel_name == "all"){
+		report("packed", run(packed, rays), ray_count);
+	}
+
+	return 0;
+}
@@ -15,100 +15,52 @@
 #include "utils2/sphere.hpp"
 #include "utils2/plane.hpp"
 #include "utils2/triangle.hpp"
+#include "utils2/quad.hpp"
+#include "utils2/disc.hpp"
 #include "utils2/hittable.hpp"
 #include "utils2/hittable_list.hpp"
+#include "utils2/arena.hpp"
+#include "utils2/scene.hpp"
+#include "utils2/instance.hpp"
 #include "utils2/camera.hpp"
 #include "utils2/material.hpp"
+#include "utils2/texture.hpp"
+#include "utils2/texture_cache.hpp"
+#include "utils2/skybox.hpp"
+#include "utils2/framebuffer.hpp"
+#include "utils2/tonemap.hpp"
+#include "utils2/render_job.hpp"
 
 using std::endl, std::cout, std::max, std::min;
 const double INF = std::numeric_limits<double>::infinity();
 
-Uint8 UINT8_LOOK_UP[] = {0, 15, 22, 27, 31, 35, 39, 42, 45, 47,
-50, 52, 55, 57, 59, 61, 63, 65, 67, 69,
-71, 73, 74, 76, 78, 79, 81, 82, 84, 85,
-87, 88, 90, 91, 93, 94, 95, 97, 98, 99,
-100, 102, 103, 104, 105, 107, 108, 109, 110, 111,
-112, 114, 115, 116, 117, 118, 119, 120, 121, 122,
-123, 124, 125, 126, 127, 128, 129, 130, 131, 132,
-133, 134, 135, 136, 137, 138, 139, 140, 141, 141,
-142, 143, 144, 145, 146, 147, 148, 148, 149, 150,
-151, 152, 153, 153, 154, 155, 156, 157, 158, 158,
-159, 160, 161, 162, 162, 163, 164, 165, 165, 166, 
-167, 168, 168, 169, 170, 171, 171, 172, 173, 174,
-174, 175, 176, 177, 177, 178, 179, 179, 180, 181,
-182, 182, 183, 184, 184, 185, 186, 186, 187, 188,
-188, 189, 190, 190, 191, 192, 192, 193, 194, 194,
-195, 196, 196, 197, 198, 198, 199, 200, 200, 201,
-201, 202, 203, 203, 204, 205, 205, 206, 206, 207,
-208, 208, 209, 210, 210, 211, 211, 212, 213, 213,
-214, 214, 215, 216, 216, 217, 217, 218, 218, 219,
-220, 220, 221, 221, 222, 222, 223, 224, 224, 225,
-225, 226, 226, 227, 228, 228, 229, 229, 230, 230,
-231, 231, 232, 233, 233, 234, 234, 235, 235, 236,
-236, 237, 237, 238, 238, 239, 240, 240, 241, 241, 
-242, 242, 243, 243, 244, 244, 245, 245, 246, 246,
-247, 247, 248, 248, 249, 249, 250, 250, 251, 251,
-252, 252, 253, 253, 254, 255};
-
-color GetPixelColor(const SDL_Surface* pSurface, const int X, const int Y){
-	const Uint8 Bpp = pSurface->format->BytesPerPixel;
-	Uint8* pPixel = (Uint8*)pSurface->pixels + Y * pSurface->pitch + X * Bpp;
-	Uint32 PixelData = *(Uint32*)pPixel;
-	SDL_Color Color = {0x00, 0x00, 0x00, SDL_ALPHA_OPAQUE};
-	SDL_GetRGB(PixelData, pSurface->format, &Color.r, &Color.g, &Color.b);
-	return color(1.0 * int(Color.r) / 255, 1.0 * int(Color.g) / 255, 1.0 * int(Color.b) / 255);
-}
-
-color skybox_color(const ray &r, const SDL_Surface* skybox){
-	vec3 v = r.direction();
-	double l = v.length();
-	double theta = -asin(v.y()/l) + M_PI_2;
-	double phi = v.x() < 0 ? atan(v.z()/v.x()) + M_PI_2 : atan(v.z()/v.x()) + 3*M_PI/2;
-	int x = int(skybox->w * phi / (2 * M_PI));
-	int y = int(skybox->h * theta / M_PI);
-	return GetPixelColor(skybox, x, y);
-}
-
-color ray_color(const ray &r, const hittable &world, const SDL_Surface* skybox, int depth, bool depth_map){
+// spread is the angular width of the ray's footprint, widened by rough bounces; it picks the skybox mip level
+color ray_color(const ray &r, const hittable &world, const mip_texture &skybox, int depth, double spread, bool depth_map){
 	hit_record rec;
 	if(depth <=0){
 		return color(0, 0, 0);
 	}
+	// the depth map only needs t, so skip building the surface interaction
+	if(depth_map){
+		if(!world.intersect(r, 0.001, INF, rec))
+			return color(0,0,0);
+		float inv_t = min(1.0f / float(rec.t), 1.0f);
+		return color(inv_t, inv_t, inv_t);
+	}
 	if(world.hit(r, 0.001, INF, rec)){
 		ray scattered;
 		color attenuation;
-		if(depth_map){
-			float inv_t = min(1.0f / float(rec.t), 1.0f);
-			return color(inv_t, inv_t, inv_t);
-		}
-		else if(rec.mat_ptr->scatter(r, rec, attenuation, scattered)){
-			return attenuation*ray_color(scattered, world, skybox, depth-1, depth_map);
+		if(rec.mat_ptr->scatter(r, rec, vec3(random_double(), random_double(), random_double()), attenuation, scattered)){
+			return attenuation*ray_color(scattered, world, skybox, depth-1, max(spread, rec.mat_ptr->roughness() * DIFFUSE_SPREAD), depth_map);
 		}
 		return color(0,0,0);
 	}
-	if(depth_map)
-		return color(0,0,0);
-	return skybox_color(r, skybox);
+	return skybox_color(r, skybox, spread);
 	// NO SKYBOX
 	// auto t = 0.5*(normalised(r.direction()).y() + 1.0);
     // return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
 }
 
-inline void set_color(const color &c, SDL_Renderer* renderer){
-	SDL_SetRenderDrawColor(renderer, static_cast<int>(255.999 * min(0.999, max(sqrt(c.x()), 0.0))), static_cast<int>(255.999 * min(0.999, max(sqrt(c.y()), 0.0))), static_cast<int>(255.999 * min(0.999, max(sqrt(c.z()), 0.0))), 255);
-}
-
-inline void draw_pixel(SDL_Renderer* renderer, SDL_Rect r, const int resolution, const color &c, const int i, const int j){
-	set_color(c, renderer);
-	if(resolution == 1){
-		SDL_RenderDrawPoint(renderer, i, j);
-		return;
-	}
-	r.x = i;
-	r.y = j;
-	SDL_RenderFillRect(renderer, &r);
-}
-
 // MAIN
 
 int main(int argv, char** args){
@@ -123,6 +75,12 @@ int main(int argv, char** args){
 	int max_depth = 1;
 	int resolution = 3;
 	const int FPS = 60;
+	// how long the loop sleeps at most when there is nothing to render or show
+	const int IDLE_TIMEOUT = 1000;
+	// the depth map is shown as is, the path traced view wants transfer gamma2 and dither
+	tonemap_settings tone;
+	tone.transfer = display_transfer::linear;
+	tone.dither = false;
 
 	// CAMERA
 	camera cam(fov, aspect_ratio, vec3(10, 0, 10), vec3(0, 1, 0));
@@ -131,36 +89,50 @@ int main(int argv, char** args){
 	const int frameDelay = 1000 / FPS;
 	const int HEIGHT = int(WIDTH / aspect_ratio);
 	float *DEPTH_BUFFER = new float[HEIGHT * WIDTH];
+	const int THREADS = render_thread_count();
 
 	// DEFINE WORLD
-	hittable_list world;
+	// objects and materials live in the arena, declared first so it outlives everything using them
+	scene_arena arena;
+	scene world;
 
-	auto material_ground = make_shared<lambertian>(color(1.0, 1.0, 1.0));
-	auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-	auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8), 0.0);
-	auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-	auto material_walls =  make_shared<metal>(color(0.8, 0.8, 0.8), 0.0);
+	auto material_ground = arena.make<lambertian>(color(1.0, 1.0, 1.0));
+	auto material_center = arena.make<lambertian>(color(0.1, 0.2, 0.5));
+	auto material_left   = arena.make<metal>(color(0.8, 0.8, 0.8), 0.0);
+	auto material_right  = arena.make<metal>(color(0.8, 0.6, 0.2), 0.0);
+	auto material_walls =  arena.make<metal>(color(0.8, 0.8, 0.8), 0.0);
 
 	// SPHERE
-	world.add(make_shared<sphere>(point3(  20.0, 1.0, -1.0),   1.0, material_right));
-	world.add(make_shared<sphere>(point3( 20.0, 10.0 * random_double(), -10.0 * random_double()),   1.0, material_right));
-	world.add(make_shared<sphere>(point3( 20.0, 10.0 * random_double(), 10.0 * random_double()),   1.0, material_ground));
-	world.add(make_shared<sphere>(point3( 20.0, 10.0 * random_double(), -1.0),   2.0 * random_double(), material_left));
-	world.add(make_shared<plane>(point3(0, -1.0f, 0), vec3(0, 1, 0), material_ground));
+	world.add(arena.make<sphere>(point3(  20.0, 1.0, -1.0),   1.0, material_right));
+	world.add(arena.make<sphere>(point3( 20.0, 10.0 * random_double(), -10.0 * random_double()),   1.0, material_right));
+	world.add(arena.make<sphere>(point3( 20.0, 10.0 * random_double(), 10.0 * random_double()),   1.0, material_ground));
+	world.add(arena.make<sphere>(point3( 20.0, 10.0 * random_double(), -1.0),   2.0 * random_double(), material_left));
+	world.add(arena.make<plane>(point3(0, -1.0f, 0), vec3(0, 1, 0), material_ground));
+
+	// INSTANCED CLUSTERS
+	// one bottom-level bvh shared by every instance, moving one only refits the top level
+	// hittable_list cluster;
+	// for(int i=0; i<50; i++)
+	// 	cluster.add(arena.make<sphere>(random_vec(-2, 2), 0.3, material_center));
+	// auto cluster_bvh = arena.make<bvh>(cluster.objects);
+	// std::vector<int> cluster_ids;
+	// for(int k=0; k<20; k++)
+	// 	cluster_ids.push_back(world.add(arena.make<instance>(cluster_bvh, transform::translation(vec3(30, 2, -40 + 4*k)) * transform::rotation(vec3(0, 1, 0), 18*k))));
+	// // per frame: world.move(cluster_ids[k], offset); view_changed = true;
+
+	world.build();
 
 	// LOAD SKYBOX
-	SDL_Surface* skybox = IMG_Load("textures/castle1.jpg");
-	if(skybox == NULL)
+	SDL_Surface* skybox_image = IMG_Load("textures/castle1.jpg");
+	if(skybox_image == NULL)
 		cout << "Failed to load skybox." << endl;
 	else
-		cout << "Skybox loaded successfully. Size:" << skybox->w << "x" << skybox->h << "." << endl; 
+		cout << "Skybox loaded successfully. Size:" << skybox_image->w << "x" << skybox_image->h << "." << endl; 
+	// looked up through a tiled mip chain, the image itself is not needed after this
+	mip_texture skybox = skybox_texture(skybox_image);
+	SDL_FreeSurface(skybox_image);
 
 
-	// Declared variables
-	Uint32 frameStart;
-	Uint32 frameTime;
-	Uint32 timeMeasure;
-	
 	// Initializing SDL2
 	if(SDL_Init(SDL_INIT_EVERYTHING) == 0)
 		cout << "SDL2 Initialized successfully." << endl;
@@ -187,23 +159,91 @@ int main(int argv, char** args){
 		return -1;
 	}
 
+	SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+	triple_buffer frame(WIDTH, HEIGHT);
+	accum_buffer film(WIDTH, HEIGHT);
+
 	bool isRunning = true;
 	SDL_Event event;
-	SDL_Rect rect;
-	rect.w = resolution;
-	rect.h = resolution;
+
+	// RENDER JOBS
+	// a frame is a job with its own copy of the camera; a newer camera cancels it between tiles
+	async_renderer jobs(WIDTH, HEIGHT, 10 * resolution, THREADS);
+	std::shared_future<job_status> last_frame;
+	// set whenever the image is out of date, frames are only rendered then
+	bool view_changed = true;
+	int frames_done = 0;
+	int frames_cancelled = 0;
+
+	auto frame_job = [&](const camera &view){
+		Uint32 renderStart = SDL_GetTicks();
+		render_job job;
+		// apply this frame's object updates (world.move / add / remove) to the bvh
+		job.on_start = [&world](){
+			world.commit();
+		};
+		// depth buffer
+		job.render_tile = [&, view](int x0, int y0, int x1, int y1){
+			for(int j=(y0 + resolution - 1) / resolution * resolution; j<y1; j+=resolution){
+				for(int i=(x0 + resolution - 1) / resolution * resolution; i<x1; i+=resolution){
+					auto u = i * 1.f / (WIDTH - 1);
+					auto v = float(HEIGHT - 1 - j) / (HEIGHT - 1);
+					ray r = view.get_ray(u, v);
+					color ray_c = ray_color(r, world, skybox, max_depth, 0.0, true);
+					// DEPTH_BUFFER[j*WIDTH + i] = ray_c[0];
+					film.fill(i, j, resolution, ray_c);
+				}
+			}
+		};
+		// path traced instead of the depth map
+		// job.render_tile = [&, view](int x0, int y0, int x1, int y1){
+		// 	for(int j=(y0 + resolution - 1) / resolution * resolution; j<y1; j+=resolution){
+		// 		for(int i=(x0 + resolution - 1) / resolution * resolution; i<x1; i+=resolution){
+		// 			color pixel_color(0, 0, 0);
+		// 			for(int k=0; k<samples_pp; k++){
+		// 				auto u = (i + random_double()) / (WIDTH - 1);
+		// 				auto v = double(HEIGHT - 1 - j + random_double()) / (HEIGHT - 1);
+		// 				ray r = view.get_ray(u, v);
+		// 				pixel_color += ray_color(r, world, skybox, max_depth, view.pixel_spread(HEIGHT / resolution), false);
+		// 			}
+		// 			film.fill(i, j, resolution, pixel_color / samples_pp);
+		// 		}
+		// 	}
+		// };
+		job.on_complete = [&, renderStart](){
+			tonemap(film, frame.back(), tone, THREADS);
+			frame.publish();
+			cout << "Drawing time " << SDL_GetTicks() - renderStart << endl;
+			// wake the loop to show the frame
+			SDL_Event wake;
+			wake.type = SDL_USEREVENT;
+			SDL_PushEvent(&wake);
+		};
+		return job;
+	};
 
 	auto START = std::chrono::high_resolution_clock::now();
 
 	// RUN LOOP
+	// input and presenting only, so input latency does not depend on how long a frame takes to render;
+	// events are waited for rather than polled, for a frame period while a frame is rendering and
+	// up to IDLE_TIMEOUT when the image is current, so an unchanged view costs no CPU
 	while(isRunning){
+		bool idle = !view_changed && !jobs.busy() && !frame.pending();
+		bool redraw = false;
 
 		// Handling events
-		while(SDL_PollEvent(&event)){
+		int has_event = SDL_WaitEventTimeout(&event, idle ? IDLE_TIMEOUT : frameDelay);
+		while(has_event){
 			switch(event.type){
 				case SDL_QUIT:
 					isRunning = false;
 					break;
+
+				case SDL_WINDOWEVENT:
+					// exposed, resized or restored windows need the image again
+					redraw = true;
+					break;
 	
 				case SDL_KEYDOWN:
 					// quiting programm
@@ -216,76 +256,49 @@ int main(int argv, char** args){
 					}
 			}
 
-			cam.handle_inputs(event);
+			// held keys move the camera on every key event, key repeat keeps it moving
+			if(event.type == SDL_KEYDOWN || event.type == SDL_KEYUP){
+				cam.handle_inputs(event);
+				view_changed = true;
+			}
+			has_event = SDL_PollEvent(&event);
 		}
 
-		// frame start
-		frameStart = SDL_GetTicks();
-
-		// RENDERING
-
-		// depth buffer
-
-		timeMeasure = Uint32(0);
-
-		for(int j=0; j<HEIGHT; j+=resolution){
-			for(int i=0; i<WIDTH; i+=resolution){
-				auto u = i * 1.f / (WIDTH - 1);
-				auto v = float(HEIGHT - 1 - j) / (HEIGHT - 1);
-				ray r = cam.get_ray(u, v);
-				auto time1 = SDL_GetTicks();
-				color ray_c = ray_color(r, world, skybox, max_depth, true);
-				timeMeasure += SDL_GetTicks() - time1;
-				// DEPTH_BUFFER[j*WIDTH + i] = ray_c[0];
-
-				// draw_pixel(renderer, rect, resolution, ray_c, i, j);
-				SDL_SetRenderDrawColor(renderer, static_cast<int>(ray_c[0] * 255), static_cast<int>(ray_c[0] * 255), static_cast<int>(ray_c[0] * 255), 255);
-				rect.x = i;
-				rect.y = j;
-				SDL_RenderFillRect(renderer, &rect);
+		// a changed view replaces the frame in flight
+		if(view_changed){
+			if(last_frame.valid()){
+				if(jobs.busy()){
+					frames_cancelled++;
+				}
+				else if(last_frame.get() == job_status::completed){
+					frames_done++;
+				}
 			}
+			last_frame = jobs.submit(frame_job(cam));
+			view_changed = false;
 		}
 
-		cout << "Drawing time " << timeMeasure << endl;
-
-
-		// while(p < WIDTH * HEIGHT){
-		// 	Uint32 renderTime = SDL_GetTicks() - frameStart;
-		// 	if(renderTime > frameDelay){
-		// 		break;
-		// 	}
-		// 	int i = p % WIDTH;
-		// 	int j = p / WIDTH * resolution;
-		// 	color pixel_color(0, 0, 0);
-		// 	for(int k=0; k<samples_pp; k++){
-		// 		auto u = (i + random_double()) / (WIDTH - 1);
-		// 		auto v = double(HEIGHT - 1 - j + random_double()) / (HEIGHT - 1);
-		// 		ray r = cam.get_ray(u, v);
-		// 		pixel_color += ray_color(r, world, skybox, max_depth, false);
-		// 	}
-		// 	draw_pixel(renderer, resolution, pixel_color / samples_pp, i, j);
-		// 	p += resolution;
-		// }
-
 		// Render
-		SDL_RenderPresent(renderer);
-		frameTime = SDL_GetTicks() - frameStart;
-		cout << frameTime << endl;
-
-		// std::cout << "Ft/Fd: " << frameTime << "/" << frameDelay << std::endl;
-
-		// if(p == WIDTH*HEIGHT && show_completion){
-		// 	show_completion = false;
-		// 	auto END = std::chrono::high_resolution_clock::now();
-		// 	cout << "RENDERING TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
-		// }
-
+		if(frame.acquire()){
+			SDL_UpdateTexture(texture, NULL, frame.front(), frame.pitch());
+			redraw = true;
+		}
+		if(redraw){
+			SDL_RenderCopy(renderer, texture, NULL, NULL);
+			SDL_RenderPresent(renderer);
+		}
 	}
-	
 
+	// the frame in flight may still publish and push an event, let it finish before SDL goes away
+	jobs.cancel();
+	jobs.wait();
+	auto END = std::chrono::high_resolution_clock::now();
+	cout << "RAN FOR: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms, " << frames_done << " frames, " << frames_cancelled << " cancelled." << endl;
+
+	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 
 	return 0;
-}
\ No newline at end of file
+}
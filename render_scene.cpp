@@ -1,4 +1,4 @@
-// compiled using g++ -I src/include -I src/SDL2_IMG/ -L src/lib -o scene render_scene.cpp -lmingw32 -lSDL2main -lSDL2 -lSDL2_image
+// compiled using g++ -I src/include -I src/SDL2_IMG/ -L src/lib -o scene render_scene.cpp -lmingw32 -lSDL2main -lSDL2 -lSDL2_image -lws2_32
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -9,70 +9,240 @@
 #include <memory>
 #include <typeinfo>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <string>
 #include "utils1/functions.hpp"
 #include "utils1/vec3.hpp"
 #include "utils1/ray.hpp"
 #include "utils1/sphere.hpp"
 #include "utils1/plane.hpp"
 #include "utils1/triangle.hpp"
+#include "utils1/quad.hpp"
+#include "utils1/disc.hpp"
 #include "utils1/hittable.hpp"
 #include "utils1/hittable_list.hpp"
+#include "utils1/arena.hpp"
+#include "utils1/bvh.hpp"
+#include "utils1/packed_bvh.hpp"
 #include "utils1/camera.hpp"
 #include "utils1/material.hpp"
+#include "utils1/texture.hpp"
+#include "utils1/texture_cache.hpp"
+#include "utils1/skybox.hpp"
+#include "utils1/sampler.hpp"
+#include "utils1/pixel_order.hpp"
+#include "utils1/framebuffer.hpp"
+#include "utils1/tonemap.hpp"
+#include "utils1/image_io.hpp"
+#include "utils1/tile_farm.hpp"
+#include "utils1/camera_path.hpp"
+#include "utils1/frame_writer.hpp"
+#include "utils1/checkpoint.hpp"
 
 using std::endl, std::cout, std::max, std::min;
 const double INF = std::numeric_limits<double>::infinity();
 
-color GetPixelColor(const SDL_Surface* pSurface, const int X, const int Y){
-	const Uint8 Bpp = pSurface->format->BytesPerPixel;
-	Uint8* pPixel = (Uint8*)pSurface->pixels + Y * pSurface->pitch + X * Bpp;
-	Uint32 PixelData = *(Uint32*)pPixel;
-	SDL_Color Color = {0x00, 0x00, 0x00, SDL_ALPHA_OPAQUE};
-	SDL_GetRGB(PixelData, pSurface->format, &Color.r, &Color.g, &Color.b);
-	return color(1.0 * int(Color.r) / 255, 1.0 * int(Color.g) / 255, 1.0 * int(Color.b) / 255);
+inline double power_heuristic(double pdf_a, double pdf_b){
+	auto a2 = pdf_a * pdf_a;
+	auto b2 = pdf_b * pdf_b;
+	return a2 + b2 > 0 ? a2 / (a2 + b2) : 0.0;
 }
 
-color skybox_color(const ray &r, const SDL_Surface* skybox){
-	vec3 v = r.direction();
-	double l = v.length();
-	double theta = -asin(v.y()/l) + M_PI_2;
-	double phi = v.x() < 0 ? atan(v.z()/v.x()) + M_PI_2 : atan(v.z()/v.x()) + 3*M_PI/2;
-	int x = int(skybox->w * phi / (2 * M_PI));
-	int y = int(skybox->h * theta / M_PI);
-	return GetPixelColor(skybox, x, y);
+// chance of next-event estimation picking the skybox instead of an area light
+inline double env_select_prob(const hittable_list &lights, const environment_light &env){
+	if(env.empty()){
+		return 0.0;
+	}
+	return lights.objects.empty() ? 1.0 : 0.5;
 }
 
-color ray_color(const ray &r, const hittable &world, const SDL_Surface* skybox, int depth){
-	hit_record rec;
-	if(depth <=0){
+// Solid angle densities of light sampling generating direction dir from o, one per
+// strategy. A direction sampled on the skybox only carries sky radiance and one
+// sampled on an area light only that light's, so each sample, and each BSDF
+// ray reaching that kind of emitter, is weighted with its own strategy's density
+// rather than with their sum
+double area_light_pdf(const point3 &o, const vec3 &dir, const hittable_list &lights, const environment_light &env){
+	return lights.objects.empty() ? 0.0 : (1 - env_select_prob(lights, env)) * lights.pdf_value(o, dir);
+}
+
+double env_light_pdf(const vec3 &dir, const hittable_list &lights, const environment_light &env){
+	double p_env = env_select_prob(lights, env);
+	return p_env > 0 ? p_env * env.pdf(dir) : 0.0;
+}
+
+// next-event estimation with one light sample, MIS weighted against the BSDF;
+// u[2] picks between the skybox and the area lights, u[0], u[1] the point on it;
+// spread is the footprint width of the light ray for the skybox lookup
+color sample_direct(const ray &r, const hit_record &rec, const hittable &world, const hittable_list &lights, const environment_light &env, const vec3 &u, double spread){
+	double p_env = env_select_prob(lights, env);
+	if(p_env == 0.0 && lights.objects.empty()){
+		return color(0, 0, 0);
+	}
+
+	vec3 dir;
+	color Le;
+	double pdf_light;
+	double t_max = INF;
+	if(u[2] < p_env){
+		double pdf_env;
+		dir = env.sample(u[0], u[1], pdf_env);
+		if(pdf_env <= 0){
+			return color(0, 0, 0);
+		}
+		Le = env.value(ray(rec.p, dir), spread);
+		pdf_light = p_env * pdf_env;
+	}
+	else{
+		dir = lights.sample_direction(rec.p, vec3(u[0], u[1], (u[2] - p_env) / (1 - p_env)));
+		hit_record lrec;
+		if(!lights.hit(ray(rec.p, dir), 0.001, INF, lrec)){
+			return color(0, 0, 0);
+		}
+		Le = lrec.mat_ptr->emitted(ray(rec.p, dir), lrec);
+		t_max = lrec.t * 0.999;
+		pdf_light = area_light_pdf(rec.p, dir, lights, env);
+	}
+
+	color f = rec.mat_ptr->eval(r, rec, dir);
+	if(pdf_light <= 0 || (f.x() == 0 && f.y() == 0 && f.z() == 0)){
 		return color(0, 0, 0);
 	}
-	if(world.hit(r, 0.001, INF, rec)){
+	if(world.occluded(ray(rec.p, dir), 0.001, t_max)){
+		return color(0, 0, 0);
+	}
+
+	double weight = power_heuristic(pdf_light, rec.mat_ptr->pdf(r, rec, dir));
+	return f * Le * (weight / pdf_light);
+}
+
+// first surface seen through one sub-pixel position, traced once and shared
+// by every sample of the pixel that uses that position
+struct primary_hit {
+	ray r;
+	hit_record rec;
+	bool found;
+};
+
+// spread is the angular width of the camera ray's footprint; it only grows along
+// the path, by the roughness of each surface, and picks the skybox mip level
+color ray_color(ray r, const hittable &world, const hittable_list &lights, const environment_light &env, sampler &smp, int depth, double spread, const primary_hit *primary = nullptr){
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+	bool specular_bounce = true;
+	double bsdf_pdf = 0.0;
+	point3 prev_p;
+
+	if(primary){
+		r = primary->r;
+	}
+
+	for(; depth > 0; depth--){
+		hit_record rec;
+		bool found;
+		if(primary){
+			rec = primary->rec;
+			found = primary->found;
+			primary = nullptr;
+		}
+		else{
+			found = world.hit(r, 0.001, INF, rec);
+		}
+		if(!found){
+			// NO SKYBOX
+			// auto t = 0.5*(normalised(r.direction()).y() + 1.0);
+			// return radiance + throughput*((1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0));
+			double weight = specular_bounce ? 1.0 : power_heuristic(bsdf_pdf, env_light_pdf(r.direction(), lights, env));
+			radiance += throughput * env.value(r, spread) * weight;
+			break;
+		}
+
+		color Le = rec.mat_ptr->emitted(r, rec);
+		if(Le.x() != 0 || Le.y() != 0 || Le.z() != 0){
+			double weight = specular_bounce ? 1.0 : power_heuristic(bsdf_pdf, area_light_pdf(prev_p, r.direction(), lights, env));
+			radiance += throughput * Le * weight;
+		}
+
+		vec3 u_light = smp.get_3d();
+		vec3 u_bsdf = smp.get_3d();
+
+		specular_bounce = rec.mat_ptr->is_specular();
+		spread = max(spread, rec.mat_ptr->roughness() * DIFFUSE_SPREAD);
+		if(!specular_bounce){
+			radiance += throughput * sample_direct(r, rec, world, lights, env, u_light, spread);
+		}
+
 		ray scattered;
 		color attenuation;
-		if(rec.mat_ptr->scatter(r, rec, attenuation, scattered)){
-			return attenuation*ray_color(scattered, world, skybox, depth-1);
+		if(!rec.mat_ptr->scatter(r, rec, u_bsdf, attenuation, scattered)){
+			break;
+		}
+		if(!specular_bounce){
+			bsdf_pdf = rec.mat_ptr->pdf(r, rec, scattered.direction());
 		}
-		return color(0,0,0);
+		throughput = throughput * attenuation;
+		prev_p = rec.p;
+		r = scattered;
 	}
-	return skybox_color(r, skybox);
-	// NO SKYBOX
-	// auto t = 0.5*(normalised(r.direction()).y() + 1.0);
-    // return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+
+	return radiance;
 }
 
-inline void set_color(const color &c, SDL_Renderer* renderer){
-	SDL_SetRenderDrawColor(renderer, static_cast<int>(255.999 * min(0.999, max(sqrt(c.x()), 0.0))), static_cast<int>(255.999 * min(0.999, max(sqrt(c.y()), 0.0))), static_cast<int>(255.999 * min(0.999, max(sqrt(c.z()), 0.0))), 255);
+// FURNACE CHECK
+// A grey sphere (albedo 0.5) under light of radiance 1 from every direction reflects
+// exactly 0.5 along every path, whichever strategy found the light. Paths start
+// around the sphere and aim inside it; the mean has to match within a few
+// standard errors
+bool furnace_case(const char *name, const hittable &world, const hittable_list &lights, const environment_light &env, int paths){
+	const double expected = 0.5;
+	independent_sampler path_smp(1);
+	double sum = 0, sum_sq = 0;
+	for(int k=0; k<paths; k++){
+		point3 o = 1.5 * random_unit_vector();
+		ray r(o, 0.3 * random_in_unit_sphere() - o);
+		double L = ray_color(r, world, lights, env, path_smp, 4, 0.0).x();
+		sum += L;
+		sum_sq += L * L;
+	}
+	double mean = sum / paths;
+	double std_error = sqrt(max(0.0, sum_sq / paths - mean * mean) / paths);
+	bool ok = fabs(mean - expected) <= 4 * std_error + 1e-4;
+	cout << name << ": " << mean << " (expected " << expected << ", standard error " << std_error << ") " << (ok ? "ok" : "FAILED") << endl;
+	return ok;
 }
 
-inline void draw_pixel(SDL_Renderer* renderer, const int resolution, const color &c, const int i, const int j){
-	set_color(c, renderer);
-	SDL_Rect r;
-	r.x = i;
-	r.y = j;
-	r.w = resolution;
-	r.h = resolution;
-	SDL_RenderFillRect(renderer, &r);
+int furnace_main(int paths){
+	auto grey = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	auto white = make_shared<diffuse_light>(color(1, 1, 1));
+	std::vector<uint32_t> texels(8 * 4, pack_texel(255, 255, 255));
+	environment_light sky(mip_texture(texels.data(), 8, 4));
+	environment_light no_sky(nullptr);
+
+	// a box of area lights around the sphere, the top one left out for the open box
+	hittable_list box;
+	box.add(make_shared<quad>(point3(-2, -2, -2), vec3(4, 0, 0), vec3(0, 0, 4), white));
+	box.add(make_shared<quad>(point3(-2, -2, -2), vec3(0, 4, 0), vec3(0, 0, 4), white));
+	box.add(make_shared<quad>(point3( 2, -2, -2), vec3(0, 4, 0), vec3(0, 0, 4), white));
+	box.add(make_shared<quad>(point3(-2, -2, -2), vec3(4, 0, 0), vec3(0, 4, 0), white));
+	box.add(make_shared<quad>(point3(-2, -2,  2), vec3(4, 0, 0), vec3(0, 4, 0), white));
+	hittable_list open_box = box;
+	box.add(make_shared<quad>(point3(-2,  2, -2), vec3(4, 0, 0), vec3(0, 0, 4), white));
+
+	hittable_list sky_world, box_world, open_world;
+	sky_world.add(make_shared<sphere>(point3(0, 0, 0), 0.5, grey));
+	box_world = sky_world;
+	open_world = sky_world;
+	for(const auto &light : box.objects){
+		box_world.add(light);
+	}
+	for(const auto &light : open_box.objects){
+		open_world.add(light);
+	}
+
+	bool ok = furnace_case("skybox only", sky_world, hittable_list(), sky, paths);
+	ok &= furnace_case("area lights only", box_world, box, no_sky, paths);
+	ok &= furnace_case("area lights and skybox", open_world, open_box, sky, paths);
+	return ok ? 0 : 1;
 }
 
 // MAIN
@@ -87,44 +257,89 @@ int main(int argv, char** args){
 	const auto fov = 60;
 	int samples_pp = 30;
 	int max_depth = 30;
+	// primary hit cache: first hits traced once for this many sub-pixel positions and reused by
+	// all samples of the pixel, which then only trace secondary rays; 0 traces every sample
+	int primary_positions = 0;
 	int resolution = 1;
 	const int FPS = 60;
+	// frame rate written into --sequence y4m streams
+	const int SEQUENCE_FPS = 30;
+	// how long the loop sleeps at most when there is nothing to render or show
+	const int IDLE_TIMEOUT = 1000;
+	// pixel order (scanline, morton, hilbert) and tile size, 0 for no tiles
+	const pixel_curve ORDER = pixel_curve::hilbert;
+	const int TILE = 16;
+	// display conversion: exposure, curve (none, reinhard, aces), transfer (linear, gamma2, srgb), dither
+	tonemap_settings tone;
+	// the window's render is saved here every CHECKPOINT_SECONDS (0 for never) and when it stops;
+	// scene --resume [file] continues from it
+	std::string checkpoint_path = "render.ckpt";
+	const int CHECKPOINT_SECONDS = 60;
+	// memory for image texture pages, shared by all textures; older pages are dropped beyond it
+	const int TEXTURE_CACHE_MB = 256;
+
+	// TEXTURES
+	// image textures are read a page at a time from files made by scene --convert-texture <image> <out.rtx>
+	if(argv > 3 && std::string(args[1]) == "--convert-texture"){
+		SDL_Surface* image = IMG_Load(args[2]);
+		if(image == NULL){
+			cout << "Failed to load " << args[2] << "." << endl;
+			return 1;
+		}
+		std::vector<uint32_t> rows = surface_texels(image);
+		bool ok = write_texture_pages(args[3], rows.data(), image->w, image->h);
+		cout << (ok ? "Wrote " : "Failed to write ") << args[3] << " (" << image->w << "x" << image->h << ")." << endl;
+		SDL_FreeSurface(image);
+		return ok ? 0 : 1;
+	}
+	texture_cache::global().set_capacity(size_t(TEXTURE_CACHE_MB) << 20);
+
+	// scene --furnace [paths] checks that light sampling and MIS add up to the light
+	// that is there, with the skybox, with area lights and with both
+	if(argv > 1 && std::string(args[1]) == "--furnace"){
+		return furnace_main(argv > 2 ? max(1, atoi(args[2])) : 200000);
+	}
 
 	// DEFINE WORLD
+	// objects and materials live in the arena, declared first so it outlives everything using them
+	scene_arena arena;
 	hittable_list world;
+	hittable_list lights;
+
+	auto material_ground = arena.make<lambertian>(color(1.0, 1.0, 1.0));
+	auto material_center = arena.make<lambertian>(color(0.1, 0.2, 0.5));
+	auto material_left   = arena.make<metal>(color(0.8, 0.8, 0.8), 0.0);
+	auto material_right  = arena.make<metal>(color(0.8, 0.6, 0.2), 0.0);
+	auto material_walls =  arena.make<metal>(color(0.8, 0.8, 0.8), 0.0);
+    // world.add(arena.make<sphere>(point3( 0.0, 0.0, -1.0),   0.5, material_center));
+    // world.add(arena.make<sphere>(point3( 1.0, 1.0,  -1.0),   0.5, material_left));
+    // world.add(arena.make<sphere>(point3( 0.0, -1.0, -1.0),   0.5, material_right));
+    // world.add(arena.make<plane>(point3(0,-0.5,-1), vec3(0,1,0),  material_ground));
+
+	// // ROOM, one quad per wall
+	// world.add(arena.make<quad>(point3(-3,0,0), vec3(6,0,0), vec3(0,0,-3), material_walls));
+	// world.add(arena.make<quad>(point3(-3,0,0), vec3(0,5,0), vec3(0,0,-3), material_walls));
+	// world.add(arena.make<quad>(point3(3,0,0), vec3(0,5,0), vec3(0,0,-3), material_walls));
+	// world.add(arena.make<quad>(point3(-3,0,-3), vec3(6,0,0), vec3(0,5,0), material_walls));
+	// world.add(arena.make<quad>(point3(-3,5,0), vec3(6,0,0), vec3(0,0,-3), material_walls));
+
+	// // CEILING LIGHT
+	// auto material_light = arena.make<diffuse_light>(color(15, 15, 15));
+	// auto light = arena.make<quad>(point3(-1,4.99,-1), vec3(2,0,0), vec3(0,0,-1), material_light);
+	// world.add(light);
+	// lights.add(light);
 
-	auto material_ground = make_shared<lambertian>(color(1.0, 1.0, 1.0));
-	auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-	auto material_left   = make_shared<metal>(color(0.8, 0.8, 0.8), 0.0);
-	auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-	auto material_walls =  make_shared<metal>(color(0.8, 0.8, 0.8), 0.0);
-    // world.add(make_shared<sphere>(point3( 0.0, 0.0, -1.0),   0.5, material_center));
-    // world.add(make_shared<sphere>(point3( 1.0, 1.0,  -1.0),   0.5, material_left));
-    // world.add(make_shared<sphere>(point3( 0.0, -1.0, -1.0),   0.5, material_right));
-    // world.add(make_shared<plane>(point3(0,-0.5,-1), vec3(0,1,0),  material_ground));
-
-	// // BOTTOM
-	// world.add(make_shared<triangle>(point3(-3,0,0), point3(3,0,0), point3(3,0,-3), material_walls));
-	// world.add(make_shared<triangle>(point3(-3,0,-3), point3(-3,0,0), point3(3,0,-3), material_walls));
-
-	// // LEFT
-	// world.add(make_shared<triangle>(point3(-3,0,0), point3(-3,5,0), point3(-3,0,-3), material_walls));
-	// world.add(make_shared<triangle>(point3(-3,5,-3), point3(-3,5,0), point3(-3,0,-3), material_walls));
-
-	// // RIGHT
-	// world.add(make_shared<triangle>(point3(3,0,0), point3(3,5,0), point3(3,0,-3), material_walls));
-	// world.add(make_shared<triangle>(point3(3,5,-3), point3(3,5,0), point3(3,0,-3), material_walls));
+	// SPHERE
+	world.add(arena.make<sphere>(point3( 1.0, 3.0, -1.0),   1.0, material_right));
 
-	// // BACK
-	// world.add(make_shared<triangle>(point3(-3,0,-3), point3(3,0,-3), point3(3,5,-3), material_walls));
-	// world.add(make_shared<triangle>(point3(3,5,-3), point3(-3,5,-3), point3(-3,0,-3), material_walls));
+	// TEXTURED, textures/water1.rtx made with scene --convert-texture textures/water1.jpg textures/water1.rtx
+	// auto material_water = arena.make<lambertian>(arena.make<image_texture>("textures/water1.rtx"));
+	// world.add(arena.make<sphere>(point3(-1.5, 1.0, -1.0), 1.0, material_water));
+	// world.add(arena.make<quad>(point3(-3,0,0), vec3(6,0,0), vec3(0,0,-3), material_water));
 
-	// // TOP
-	// world.add(make_shared<triangle>(point3(-3,5,0), point3(3,5,0), point3(3,5,-3), material_walls));
-	// world.add(make_shared<triangle>(point3(-3,5,-3), point3(-3,5,0), point3(3,5,-3), material_walls));
-
-	// SPHERE
-	world.add(make_shared<sphere>(point3( 1.0, 3.0, -1.0),   1.0, material_right));
+	// ACCELERATION STRUCTURE
+	// spheres and triangles are copied into flat records, the scene is static after this
+	packed_bvh accel(world.objects);
 
 	// LOAD SKYBOX
 	SDL_Surface* skybox = IMG_Load("textures/castle1.jpg");
@@ -134,35 +349,390 @@ int main(int argv, char** args){
 	else{
 		cout << "Skybox loaded successfully. Size:" << skybox->w << "x" << skybox->h << "." << endl; 
 	}
+	// the light keeps its own tiled mip chain of the image
+	environment_light env(skybox);
+	SDL_FreeSurface(skybox);
+
+	// SAMPLER (independent_sampler, stratified_sampler, sobol_sampler, blue_noise_sampler)
+	sobol_sampler smp(samples_pp, 125);
 
 	// CALCULATED VARIABLES
 	const int frameDelay = 1000 / FPS;
 	const int HEIGHT = int(WIDTH / aspect_ratio);
-	bool show_completion = true;
-	int p = 0;
+	const std::vector<pixel_pos> order = pixel_order((WIDTH + resolution - 1) / resolution, (HEIGHT + resolution - 1) / resolution, TILE, ORDER);
+	const int THREADS = render_thread_count();
+	// pixels are handed to the render threads in chunks of the pixel order,
+	// the image so far is published after every batch of chunks
+	const int CHUNK = 256;
+	const int BATCH = 4 * THREADS;
+	// tile edge handed to farm workers
+	const int FARM_TILE = 32;
 
 	// CAMERA
 	camera cam(fov, aspect_ratio, point3(0, 2, 3), point3(0, 2, 0), vec3(0, 1, 0));
 
-	// Declared variables
-	Uint32 frameStart;
-	Uint32 frameTime;
-	
+	// PIXEL
+	// averaged samples of pixel (i, j) of a width x height image, shared by every mode;
+	// primary holds primary_positions scratch entries for the hit cache
+	auto render_pixel = [&](int i, int j, int width, int height, sampler &local_smp, std::vector<primary_hit> &primary){
+		// the cached positions are the jitters of the pixel's first samples
+		for(int m=0; m<primary_positions; m++){
+			double jx, jy;
+			local_smp.start_pixel_sample(i, j, m);
+			local_smp.get_2d(jx, jy);
+			auto u = (i + jx) / (width - 1);
+			auto v = double(height - 1 - j + jy) / (height - 1);
+			primary[m].r = cam.get_ray(u, v);
+			primary[m].found = accel.hit(primary[m].r, 0.001, INF, primary[m].rec);
+		}
+		double spread = cam.pixel_spread(height);
+		color pixel_color(0, 0, 0);
+		for(int k=0; k<samples_pp; k++){
+			double jx, jy;
+			local_smp.start_pixel_sample(i, j, k);
+			local_smp.get_2d(jx, jy);
+			if(primary_positions > 0){
+				pixel_color += ray_color(ray(), accel, lights, env, local_smp, max_depth, spread, &primary[k % primary_positions]);
+				continue;
+			}
+			auto u = (i + jx) / (width - 1);
+			auto v = double(height - 1 - j + jy) / (height - 1);
+			ray r = cam.get_ray(u, v);
+			pixel_color += ray_color(r, accel, lights, env, local_smp, max_depth, spread);
+		}
+		return pixel_color / samples_pp;
+	};
+
+	// FARM MODES
+	// scene --coordinator [address:]<port> [local workers] [out.ppm|out.pfm] renders headless on worker processes,
+	// scene --worker <host> <port> renders tiles for a coordinator; both run this binary's scene.
+	// The coordinator listens on loopback only, unless given an address such as 0.0.0.0:5601
+	const std::string mode = argv > 1 ? args[1] : "";
+	if(mode == "--coordinator" && argv > 2){
+		net_init();
+		const std::string where = args[2];
+		const size_t colon = where.rfind(':');
+		const std::string address = colon == std::string::npos ? "127.0.0.1" : where.substr(0, colon);
+		const int port = atoi(where.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+		const int local_workers = argv > 3 ? atoi(args[3]) : 0;
+		const std::string out = argv > 4 ? args[4] : "render.ppm";
+		auto START = std::chrono::high_resolution_clock::now();
+
+		// local workers are started as plain processes and connect like remote ones
+		const std::string local_host = address == "0.0.0.0" ? "127.0.0.1" : address;
+		std::vector<std::thread> spawned;
+		for(int w=0; w<local_workers; w++){
+			std::string command = "\"" + std::string(args[0]) + "\" --worker " + local_host + " " + std::to_string(port);
+			spawned.emplace_back([command](){ std::system(command.c_str()); });
+		}
+
+		tile_coordinator farm(WIDTH, HEIGHT, FARM_TILE);
+		int shown = -1;
+		bool ok = farm.run(port, [&](int done, int total){
+			if(done * 100 / total != shown){
+				shown = done * 100 / total;
+				cout << "\rTILES: " << done << "/" << total << std::flush;
+			}
+		}, address);
+		for(auto &t : spawned){
+			t.join();
+		}
+		if(!ok){
+			cout << "Failed to listen on " << address << ":" << port << "." << endl;
+			return 1;
+		}
+
+		auto END = std::chrono::high_resolution_clock::now();
+		cout << endl << "RENDERING TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
+
+		if(out.size() > 4 && out.compare(out.size() - 4, 4, ".pfm") == 0){
+			ok = write_pfm(out, farm.film);
+		}
+		else{
+			std::vector<uint32_t> pixels(size_t(WIDTH) * HEIGHT);
+			tonemap(farm.film, pixels.data(), tone, THREADS);
+			ok = write_ppm(out, pixels.data(), WIDTH, HEIGHT);
+		}
+		cout << (ok ? "Saved " : "Failed to save ") << out << "." << endl;
+		return ok ? 0 : 1;
+	}
+	if(mode == "--worker" && argv > 3){
+		net_init();
+		bool ok = run_tile_worker(args[2], atoi(args[3]), WIDTH, HEIGHT, [&](const farm_tile &t, float *rgb){
+			int w = t.x1 - t.x0;
+			parallel_for(t.y1 - t.y0, THREADS, [&](int row){
+				auto local_smp = smp.clone();
+				std::vector<primary_hit> primary(primary_positions);
+				float *out = rgb + size_t(row) * w * 3;
+				for(int i=t.x0; i<t.x1; i++, out+=3){
+					color c = render_pixel(i, t.y0 + row, WIDTH, HEIGHT, *local_smp, primary);
+					out[0] = float(c.x());
+					out[1] = float(c.y());
+					out[2] = float(c.z());
+				}
+			});
+		});
+		if(!ok){
+			cout << "Lost the coordinator at " << args[2] << ":" << args[3] << "." << endl;
+		}
+		return ok ? 0 : 1;
+	}
+
+	// SEQUENCE MODE
+	// scene --sequence <frames> <out.y4m|frame_%04d.ppm> [keys.txt] renders a camera flythrough headless;
+	// the world, skybox and bvh above are built once and shared by every frame
+	if(mode == "--sequence" && argv > 3){
+		const int frames = max(1, atoi(args[2]));
+		const std::string out = args[3];
+
+		camera_path path;
+		if(argv > 4 && !path.load(args[4])){
+			cout << "Failed to load camera keys " << args[4] << "." << endl;
+			return 1;
+		}
+		if(path.empty()){
+			// default flythrough, from the window's view around the sphere
+			path.add({0.0, point3(0, 2, 3), point3(0, 2, 0), double(fov)});
+			path.add({1.0, point3(2, 2.5, 2.5), point3(0.5, 2.5, -1), double(fov)});
+			path.add({2.0, point3(3, 3, 0.5), point3(1, 3, -1), double(fov)});
+		}
+
+		// y4m frames go to one stream, anything else is a printf pattern for numbered PPMs
+		const bool y4m = out.size() > 4 && out.compare(out.size() - 4, 4, ".y4m") == 0;
+		std::unique_ptr<y4m_writer> stream;
+		if(y4m){
+			stream = std::make_unique<y4m_writer>(out, WIDTH, HEIGHT, SEQUENCE_FPS);
+			if(!stream->is_open()){
+				cout << "Failed to open " << out << "." << endl;
+				return 1;
+			}
+		}
+		const std::string pattern = out.find('%') == std::string::npos ? out + "%04d.ppm" : out;
+		if(!y4m && frame_path(pattern, 0).empty()){
+			cout << "Frame pattern " << out << " needs exactly one %d (like frame_%04d.ppm), write a literal % as %%." << endl;
+			return 1;
+		}
+		frame_writer writer([&](int index, const std::vector<uint32_t> &argb){
+			if(y4m){
+				return stream->write_frame(argb.data());
+			}
+			return write_ppm(frame_path(pattern, index), argb.data(), WIDTH, HEIGHT);
+		});
+
+		accum_buffer film(WIDTH, HEIGHT);
+		auto START = std::chrono::high_resolution_clock::now();
+		for(int f=0; f<frames; f++){
+			auto FRAME_START = std::chrono::high_resolution_clock::now();
+			cam = path.at(path.start() + (path.end() - path.start()) * f / max(1, frames - 1), aspect_ratio);
+			parallel_for(HEIGHT, THREADS, [&](int j){
+				auto local_smp = smp.clone();
+				std::vector<primary_hit> primary(primary_positions);
+				for(int i=0; i<WIDTH; i++){
+					film.fill(i, j, 1, render_pixel(i, j, WIDTH, HEIGHT, *local_smp, primary));
+				}
+			});
+			std::vector<uint32_t> pixels(size_t(WIDTH) * HEIGHT);
+			tonemap(film, pixels.data(), tone, THREADS);
+			writer.push(f, std::move(pixels));
+			auto FRAME_END = std::chrono::high_resolution_clock::now();
+			cout << "FRAME " << f + 1 << "/" << frames << ": " << std::chrono::duration_cast<std::chrono::milliseconds>(FRAME_END - FRAME_START).count() << "ms." << endl;
+		}
+		bool ok = writer.finish() && (!y4m || stream->close());
+
+		auto END = std::chrono::high_resolution_clock::now();
+		cout << "SEQUENCE TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
+		if(!ok){
+			cout << "Failed to write " << out << "." << endl;
+		}
+		return ok ? 0 : 1;
+	}
+
+	// TILED MODE
+	// scene --tiled <width> <out.tpf|out.pfm> [tile] renders any width headless, tile by tile; finished tiles
+	// go straight to a tiled file, so memory holds one tile per thread whatever the image size.
+	// A .pfm target is converted from the tiled file at the end, one row of tiles at a time
+	if(mode == "--tiled" && argv > 3){
+		const int width = max(2, atoi(args[2]));
+		const int height = max(2, int(width / aspect_ratio));
+		const std::string out = args[3];
+		const int tile = argv > 4 ? max(1, atoi(args[4])) : 64;
+		const bool pfm = out.size() > 4 && out.compare(out.size() - 4, 4, ".pfm") == 0;
+		const std::string tiled_path = pfm ? out + ".tpf" : out;
+
+		tiled_image_writer image(tiled_path, width, height, tile);
+		if(!image.is_open()){
+			cout << "Failed to open " << tiled_path << "." << endl;
+			return 1;
+		}
+		const int total = image.tiles_x * image.tiles_y;
+		std::atomic<int> done(0);
+		std::atomic<bool> ok(true);
+		auto START = std::chrono::high_resolution_clock::now();
+		parallel_for(total, THREADS, [&](int t){
+			int x0 = (t % image.tiles_x) * tile;
+			int y0 = (t / image.tiles_x) * tile;
+			auto local_smp = smp.clone();
+			std::vector<primary_hit> primary(primary_positions);
+			std::vector<float> rgb(size_t(tile) * tile * 3, 0.0f);
+			for(int j=y0; j<min(y0 + tile, height); j++){
+				for(int i=x0; i<min(x0 + tile, width); i++){
+					color c = render_pixel(i, j, width, height, *local_smp, primary);
+					float *p = rgb.data() + (size_t(j - y0) * tile + (i - x0)) * 3;
+					p[0] = float(c.x());
+					p[1] = float(c.y());
+					p[2] = float(c.z());
+				}
+			}
+			if(!image.write_tile(t % image.tiles_x, t / image.tiles_x, rgb.data())){
+				ok = false;
+			}
+			int d = ++done;
+			if(d % 64 == 0 || d == total){
+				cout << "\rTILES: " << d << "/" << total << std::flush;
+			}
+		});
+		ok = image.close() && ok;
+
+		auto END = std::chrono::high_resolution_clock::now();
+		cout << endl << "RENDERING TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
+
+		if(ok && pfm){
+			ok = tiled_to_pfm(tiled_path, out);
+			if(ok){
+				remove(tiled_path.c_str());
+			}
+		}
+		cout << (ok ? "Saved " : "Failed to save ") << out << " (" << width << "x" << height << ")." << endl;
+		return ok ? 0 : 1;
+	}
+
 	SDL_Init(SDL_INIT_EVERYTHING);
 
 	SDL_Window *window = SDL_CreateWindow("Rendering", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, 0);
 	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
 
-	bool isRunning = true;
+	SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+	triple_buffer frame(WIDTH, HEIGHT);
+	accum_buffer film(WIDTH, HEIGHT);
+
+	// CHECKPOINT
+	checkpoint_header progress;
+	progress.width = WIDTH;
+	progress.height = HEIGHT;
+	progress.samples_pp = samples_pp;
+	progress.max_depth = max_depth;
+	progress.primary_positions = primary_positions;
+	progress.resolution = resolution;
+	progress.sampler_seed = smp.seed;
+	progress.sampler_kind = uint32_t(smp.type());
+	// samples per pixel so far, pixels that have all of them are skipped; the counts are
+	// 16 bit, so a finished pixel is marked with samples_pp clamped to that
+	std::vector<uint16_t> pixel_samples(size_t(WIDTH) * HEIGHT, 0);
+	const uint16_t samples_done = uint16_t(min(samples_pp, int(UINT16_MAX)));
+	if(mode == "--resume"){
+		if(argv > 2){
+			checkpoint_path = args[2];
+		}
+		auto saved = load_checkpoint(checkpoint_path, progress);
+		if(saved){
+			film.r = saved->film.r;
+			film.g = saved->film.g;
+			film.b = saved->film.b;
+			pixel_samples = saved->samples;
+			progress.seconds = saved->header.seconds;
+			size_t done = std::count(pixel_samples.begin(), pixel_samples.end(), samples_done);
+			cout << "Resuming " << checkpoint_path << ": " << done << "/" << pixel_samples.size() << " pixels after " << int(progress.seconds) << "s." << endl;
+		}
+		else{
+			cout << "No checkpoint for these settings in " << checkpoint_path << ", starting over." << endl;
+		}
+	}
+	checkpoint_writer checkpoints(checkpoint_path);
+	// copies the render state for the writer thread, only called between batches
+	auto save_progress = [&](double seconds){
+		auto c = std::make_unique<render_checkpoint>(progress);
+		c->header.seconds = progress.seconds + seconds;
+		c->film.r = film.r;
+		c->film.g = film.g;
+		c->film.b = film.b;
+		c->samples = pixel_samples;
+		checkpoints.submit(std::move(c));
+	};
+
+	std::atomic<bool> isRunning(true);
+	std::atomic<bool> renderDone(false);
 	SDL_Event event;
 
 	auto START = std::chrono::high_resolution_clock::now();
 
+	// RENDER THREAD
+	std::thread render_thread([&](){
+		auto last_save = std::chrono::high_resolution_clock::now();
+		auto seconds = [&](){ return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - START).count(); };
+		if(progress.seconds > 0){
+			tonemap(film, frame.back(), tone, THREADS);
+			frame.publish();
+		}
+
+		const int chunks = (int(order.size()) + CHUNK - 1) / CHUNK;
+		for(int first=0; first<chunks && isRunning; first+=BATCH){
+			parallel_for(min(BATCH, chunks - first), THREADS, [&](int c){
+				auto local_smp = smp.clone();
+				std::vector<primary_hit> primary(primary_positions);
+				int begin = (first + c) * CHUNK;
+				int end = min(begin + CHUNK, int(order.size()));
+				for(int p=begin; p<end && isRunning; p++){
+					int i = order[p].x * resolution;
+					int j = order[p].y * resolution;
+					if(pixel_samples[size_t(j) * WIDTH + i] >= samples_done){
+						continue;
+					}
+					color pixel_color = render_pixel(i, j, WIDTH, HEIGHT, *local_smp, primary);
+					film.fill(i, j, resolution, pixel_color);
+					for(int y=j; y<min(j + resolution, HEIGHT); y++){
+						for(int x=i; x<min(i + resolution, WIDTH); x++){
+							pixel_samples[size_t(y) * WIDTH + x] = samples_done;
+						}
+					}
+				}
+			});
+			tonemap(film, frame.back(), tone, THREADS);
+			frame.publish();
+
+			if(CHECKPOINT_SECONDS > 0 && std::chrono::high_resolution_clock::now() - last_save > std::chrono::seconds(CHECKPOINT_SECONDS)){
+				save_progress(seconds());
+				last_save = std::chrono::high_resolution_clock::now();
+			}
+		}
+
+		if(isRunning){
+			auto END = std::chrono::high_resolution_clock::now();
+			cout << "RENDERING TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
+		}
+		// finished or closed, either way the next run can pick up from here
+		if(CHECKPOINT_SECONDS > 0){
+			save_progress(seconds());
+		}
+
+		// wake the loop so the last batch is shown before it goes idle
+		renderDone = true;
+		SDL_Event wake;
+		wake.type = SDL_USEREVENT;
+		SDL_PushEvent(&wake);
+	});
+
 	// RUN LOOP
+	// only input and presenting happen here, so the window stays responsive however long a frame takes;
+	// events are waited for rather than polled, for a frame period while rendering and
+	// up to IDLE_TIMEOUT once the image is done, so a finished render costs no CPU
 	while (isRunning)
 	{	
+		bool idle = renderDone && !frame.pending();
+		bool redraw = false;
+
 		// Handling events
-		while (SDL_PollEvent(&event))
+		int has_event = SDL_WaitEventTimeout(&event, idle ? IDLE_TIMEOUT : frameDelay);
+		while (has_event)
 		{
 			switch(event.type)
 			{
@@ -170,6 +740,11 @@ int main(int argv, char** args){
 				isRunning = false;
 				break;
 
+			case SDL_WINDOWEVENT:
+				// exposed, resized or restored windows need the image again
+				redraw = true;
+				break;
+
 			case SDL_KEYDOWN:
 				// quiting programm
 				if(event.key.keysym.sym == SDLK_ESCAPE)
@@ -182,45 +757,23 @@ int main(int argv, char** args){
 					SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 				}
 			}
-		}
-
-		// frame start
-		frameStart = SDL_GetTicks();
-
-		// RENDERING
-		while(p < WIDTH * HEIGHT){
-			Uint32 renderTime = SDL_GetTicks() - frameStart;
-			if(renderTime > frameDelay){
-				break;
-			}
-			int i = p % WIDTH;
-			int j = p / WIDTH * resolution;
-			color pixel_color(0, 0, 0);
-			for(int k=0; k<samples_pp; k++){
-				auto u = (i + random_double()) / (WIDTH - 1);
-				auto v = double(HEIGHT - 1 - j + random_double()) / (HEIGHT - 1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, world, skybox, max_depth);
-			}
-			draw_pixel(renderer, resolution, pixel_color / samples_pp, i, j);
-			p += resolution;
+			has_event = SDL_PollEvent(&event);
 		}
 
 		// Render
-		SDL_RenderPresent(renderer);
-		frameTime = SDL_GetTicks() - frameStart;
-
-		// std::cout << "Ft/Fd: " << frameTime << "/" << frameDelay << std::endl;
-
-		if(p == WIDTH*HEIGHT && show_completion){
-			show_completion = false;
-			auto END = std::chrono::high_resolution_clock::now();
-			cout << "RENDERING TOOK: " << std::chrono::duration_cast<std::chrono::milliseconds>(END - START).count() << "ms." << endl;
+		if(frame.acquire()){
+			SDL_UpdateTexture(texture, NULL, frame.front(), frame.pitch());
+			redraw = true;
+		}
+		if(redraw){
+			SDL_RenderCopy(renderer, texture, NULL, NULL);
+			SDL_RenderPresent(renderer);
 		}
-
 	}
-	
 
+	render_thread.join();
+
+	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
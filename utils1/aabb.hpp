@@ -0,0 +1,87 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "vec3.hpp"
+#include "ray.hpp"
+
+class aabb {
+    public:
+        aabb() : minimum(INFINITY, INFINITY, INFINITY), maximum(-INFINITY, -INFINITY, -INFINITY) {}
+        aabb(const point3 &a, const point3 &b) : minimum(a), maximum(b) {}
+
+        point3 min() const {return minimum; }
+        point3 max() const {return maximum; }
+
+        bool empty() const {
+            return minimum.x() > maximum.x() || minimum.y() > maximum.y() || minimum.z() > maximum.z();
+        }
+
+        point3 centroid() const {
+            return 0.5 * (minimum + maximum);
+        }
+
+        double surface_area() const {
+            if(empty()){
+                return 0.0;
+            }
+            vec3 d = maximum - minimum;
+            return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        void expand(const aabb &b){
+            for(int a=0; a<3; a++){
+                minimum[a] = fmin(minimum[a], b.minimum[a]);
+                maximum[a] = fmax(maximum[a], b.maximum[a]);
+            }
+        }
+
+        void expand(const point3 &p){
+            for(int a=0; a<3; a++){
+                minimum[a] = fmin(minimum[a], p[a]);
+                maximum[a] = fmax(maximum[a], p[a]);
+            }
+        }
+
+        bool contains(const aabb &b) const {
+            for(int a=0; a<3; a++){
+                if(b.minimum[a] < minimum[a] || b.maximum[a] > maximum[a]){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // slab test with the reciprocal ray direction precomputed by the caller
+        bool hit(const point3 &orig, const vec3 &inv_dir, double t_min, double t_max) const {
+            for(int a=0; a<3; a++){
+                auto t0 = (minimum[a] - orig[a]) * inv_dir[a];
+                auto t1 = (maximum[a] - orig[a]) * inv_dir[a];
+                if(inv_dir[a] < 0){
+                    std::swap(t0, t1);
+                }
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if(t_max < t_min){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool hit(const ray &r, double t_min, double t_max) const {
+            vec3 d = r.direction();
+            return hit(r.origin(), vec3(1/d.x(), 1/d.y(), 1/d.z()), t_min, t_max);
+        }
+
+    public:
+        point3 minimum;
+        point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb &a, const aabb &b){
+    aabb box = a;
+    box.expand(b);
+    return box;
+}
+
+#endif
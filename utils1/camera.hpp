@@ -28,6 +28,11 @@ class camera {
             return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin);
         }
 
+        // angle one of height rows covers at the image center, the width of a primary ray's footprint
+        double pixel_spread(int height) const {
+            return vertical.length() / height;
+        }
+
     private:
         point3 origin;
         point3 lower_left_corner;
@@ -0,0 +1,106 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include "vec3.hpp"
+#include "camera.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct camera_key {
+    double time;
+    point3 look_from;
+    point3 look_at;
+    double vfov;
+};
+
+// Camera keyframes. Eye and target follow Catmull-Rom splines through the
+// keys, with tangents scaled to each segment's length in time so uneven
+// spacing does not overshoot; the field of view is interpolated linearly.
+class camera_path {
+    public:
+        camera_path() {}
+
+        // keys must be added in increasing time
+        void add(const camera_key &k){
+            keys.push_back(k);
+        }
+
+        // reads "time from.x from.y from.z at.x at.y at.z vfov" per line, # starts a comment
+        bool load(const std::string &path);
+
+        bool empty() const {return keys.empty(); }
+        double start() const {return keys.front().time; }
+        double end() const {return keys.back().time; }
+
+        camera at(double t, double aspect_ratio, vec3 vup = vec3(0, 1, 0)) const;
+
+    public:
+        std::vector<camera_key> keys;
+
+    private:
+        // tangent of member m at key i, in units of segment [seg, seg + 1]
+        template<typename M>
+        vec3 tangent(size_t i, size_t seg, M m) const {
+            size_t prev = i > 0 ? i - 1 : i;
+            size_t next = i + 1 < keys.size() ? i + 1 : i;
+            double span = keys[next].time - keys[prev].time;
+            if(span <= 0){
+                return vec3(0, 0, 0);
+            }
+            return (keys[next].*m - keys[prev].*m) * ((keys[seg + 1].time - keys[seg].time) / span);
+        }
+};
+
+bool camera_path::load(const std::string &path){
+    std::ifstream in(path);
+    if(!in){
+        return false;
+    }
+    std::string line;
+    while(std::getline(in, line)){
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        camera_key k;
+        double fx, fy, fz, ax, ay, az;
+        if(fields >> k.time >> fx >> fy >> fz >> ax >> ay >> az >> k.vfov){
+            k.look_from = point3(fx, fy, fz);
+            k.look_at = point3(ax, ay, az);
+            add(k);
+        }
+    }
+    return !keys.empty();
+}
+
+camera camera_path::at(double t, double aspect_ratio, vec3 vup) const {
+    if(keys.size() == 1 || t <= start()){
+        return camera(keys.front().vfov, aspect_ratio, keys.front().look_from, keys.front().look_at, vup);
+    }
+    if(t >= end()){
+        return camera(keys.back().vfov, aspect_ratio, keys.back().look_from, keys.back().look_at, vup);
+    }
+
+    size_t i = 0;
+    while(keys[i + 1].time < t){
+        i++;
+    }
+    const camera_key &a = keys[i];
+    const camera_key &b = keys[i + 1];
+    double s = b.time > a.time ? (t - a.time) / (b.time - a.time) : 0.0;
+
+    // cubic Hermite basis
+    double s2 = s * s, s3 = s2 * s;
+    double h00 = 2*s3 - 3*s2 + 1;
+    double h10 = s3 - 2*s2 + s;
+    double h01 = -2*s3 + 3*s2;
+    double h11 = s3 - s2;
+
+    point3 from = h00*a.look_from + h10*tangent(i, i, &camera_key::look_from) + h01*b.look_from + h11*tangent(i + 1, i, &camera_key::look_from);
+    point3 to = h00*a.look_at + h10*tangent(i, i, &camera_key::look_at) + h01*b.look_at + h11*tangent(i + 1, i, &camera_key::look_at);
+    double vfov = a.vfov + (b.vfov - a.vfov) * s;
+    return camera(vfov, aspect_ratio, from, to, vup);
+}
+
+#endif
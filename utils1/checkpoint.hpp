@@ -0,0 +1,172 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "tonemap.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Everything a progressive render needs to carry on after a restart. The
+// samplers are deterministic in (pixel, sample, dimension), so their state
+// is just the kind, seed and sample count; with those matching, a resumed
+// render produces the same image as an uninterrupted one. The independent
+// sampler draws from rand() and is only resumable approximately.
+struct checkpoint_header {
+    char magic[4] = {'R', 'T', 'C', 'K'};
+    int32_t version = 2;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t samples_pp = 0;
+    int32_t max_depth = 0;
+    int32_t primary_positions = 0;
+    int32_t resolution = 1;
+    uint32_t sampler_seed = 0;
+    // a sampler_type
+    uint32_t sampler_kind = 0;
+    // render time spent before the checkpoint
+    double seconds = 0;
+
+    // same render settings, the time is allowed to differ
+    bool matches(const checkpoint_header &o) const {
+        return memcmp(magic, o.magic, 4) == 0 && version == o.version && width == o.width && height == o.height
+            && samples_pp == o.samples_pp && max_depth == o.max_depth && primary_positions == o.primary_positions
+            && resolution == o.resolution && sampler_seed == o.sampler_seed && sampler_kind == o.sampler_kind;
+    }
+};
+
+struct render_checkpoint {
+    render_checkpoint(const checkpoint_header &h) : header(h), film(h.width, h.height), samples(size_t(h.width) * h.height, 0) {}
+
+    checkpoint_header header;
+    accum_buffer film;
+    // samples accumulated per pixel, 0 for pixels not rendered yet
+    std::vector<uint16_t> samples;
+};
+
+// header, the sample counts, then r, g, b floats of the rendered pixels only, so a
+// checkpoint early in a render is small. Written next to the target and renamed
+// over it, so a crash during the write leaves the previous checkpoint intact
+inline bool save_checkpoint(const std::string &path, const render_checkpoint &c){
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if(f == NULL){
+        return false;
+    }
+    bool ok = fwrite(&c.header, sizeof(c.header), 1, f) == 1;
+    ok = ok && fwrite(c.samples.data(), sizeof(uint16_t), c.samples.size(), f) == c.samples.size();
+    std::vector<float> rgb;
+    rgb.reserve(size_t(c.header.width) * 3);
+    for(int y=0; y<c.header.height && ok; y++){
+        rgb.clear();
+        for(int x=0; x<c.header.width; x++){
+            size_t p = size_t(y) * c.header.width + x;
+            if(c.samples[p] > 0){
+                rgb.push_back(c.film.r[p]);
+                rgb.push_back(c.film.g[p]);
+                rgb.push_back(c.film.b[p]);
+            }
+        }
+        ok = fwrite(rgb.data(), sizeof(float), rgb.size(), f) == rgb.size();
+    }
+    ok = fclose(f) == 0 && ok;
+
+    std::error_code err;
+    if(ok){
+        std::filesystem::rename(tmp, path, err);
+    }
+    if(!ok || err){
+        std::filesystem::remove(tmp, err);
+        return false;
+    }
+    return true;
+}
+
+// null when the file is missing, damaged or from a render with other settings
+inline std::unique_ptr<render_checkpoint> load_checkpoint(const std::string &path, const checkpoint_header &expected){
+    FILE *f = fopen(path.c_str(), "rb");
+    if(f == NULL){
+        return nullptr;
+    }
+    checkpoint_header h;
+    if(fread(&h, sizeof(h), 1, f) != 1 || !h.matches(expected)){
+        fclose(f);
+        return nullptr;
+    }
+    auto c = std::make_unique<render_checkpoint>(h);
+    bool ok = fread(c->samples.data(), sizeof(uint16_t), c->samples.size(), f) == c->samples.size();
+    for(size_t p=0; p<c->samples.size() && ok; p++){
+        if(c->samples[p] > 0){
+            float rgb[3];
+            ok = fread(rgb, sizeof(float), 3, f) == 3;
+            c->film.r[p] = rgb[0];
+            c->film.g[p] = rgb[1];
+            c->film.b[p] = rgb[2];
+        }
+    }
+    fclose(f);
+    return ok ? std::move(c) : nullptr;
+}
+
+// Saves checkpoints on a background thread. submit() only swaps in the new
+// snapshot and returns; if the previous one is still being written, an
+// unwritten older snapshot is replaced rather than queued.
+class checkpoint_writer {
+    public:
+        checkpoint_writer(const std::string &file) : path(file) {
+            worker = std::thread([this](){ run(); });
+        }
+
+        ~checkpoint_writer(){
+            {
+                std::lock_guard<std::mutex> lock(m);
+                closed = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+        void submit(std::unique_ptr<render_checkpoint> c){
+            {
+                std::lock_guard<std::mutex> lock(m);
+                pending = std::move(c);
+            }
+            wake.notify_one();
+        }
+
+    public:
+        const std::string path;
+
+    private:
+        void run(){
+            for(;;){
+                std::unique_ptr<render_checkpoint> c;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    wake.wait(lock, [&](){ return closed || pending; });
+                    if(!pending){
+                        return;
+                    }
+                    c = std::move(pending);
+                }
+                if(!save_checkpoint(path, *c)){
+                    fprintf(stderr, "failed to write checkpoint %s\n", path.c_str());
+                }
+            }
+        }
+
+    private:
+        std::unique_ptr<render_checkpoint> pending;
+        bool closed = false;
+        std::mutex m;
+        std::condition_variable wake;
+        std::thread worker;
+};
+
+#endif
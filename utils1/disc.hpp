@@ -0,0 +1,105 @@
+#ifndef DISC_H
+#define DISC_H
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "vec3.hpp"
+#include "onb.hpp"
+#include <memory>
+
+// Flat disc, a bounded stand-in for plane (floors, round lights). (u, v) of a
+// hit are the angle as a fraction of a turn and the distance from the centre
+// as a fraction of the radius.
+class disc : public hittable {
+    public:
+        disc() {}
+        disc(point3 cen, vec3 n, double r, std::shared_ptr<material> m) : center(cen), normal(unit_vector(n)), radius(r), mat_ptr(m), frame(n) {};
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void translate(const vec3& offset) override {center += offset;}
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 sample_direction(const point3& o, const vec3& u) const override;
+
+    private:
+        // t and the hit's offset from the centre
+        bool intersect_plane(const ray& r, double t_min, double t_max, double& t, vec3& offset) const{
+            double denom = dot(normal, r.direction());
+            if(denom == 0){
+                return false;
+            }
+            vec3 tvec = r.origin() - center;
+            t = -dot(normal, tvec) / denom;
+            if(!(t > t_min && t < t_max)){
+                return false;
+            }
+            offset = tvec + t * r.direction();
+            return offset.length_squared() <= radius*radius;
+        }
+
+    public:
+        point3 center;
+        vec3 normal;
+        double radius;
+        std::shared_ptr<material> mat_ptr;
+        onb frame;
+};
+
+bool disc::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    double t;
+    vec3 offset;
+    if(!intersect_plane(r, t_min, t_max, t, offset)){
+        return false;
+    }
+    rec.t = t;
+    rec.u = 0.5 + atan2(dot(offset, frame.v()), dot(offset, frame.u())) / (2*M_PI);
+    rec.v = offset.length() / radius;
+    rec.obj = this;
+    return true;
+}
+
+void disc::finalize(const ray& r, hit_record& rec) const{
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, normal);
+    rec.mat_ptr = mat_ptr;
+}
+
+bool disc::occluded(const ray& r, double t_min, double t_max) const{
+    double t;
+    vec3 offset;
+    return intersect_plane(r, t_min, t_max, t, offset);
+}
+
+// the extent along each axis is radius times the sine of the normal's angle to it
+bool disc::bounding_box(aabb& output_box) const{
+    vec3 extent;
+    for(int a=0; a<3; a++){
+        extent[a] = radius * sqrt(std::max(0.0, 1 - normal[a]*normal[a]));
+    }
+    output_box = aabb(center - extent, center + extent);
+    return true;
+}
+
+// uniform sampling by area, converted to solid angle as seen from o
+double disc::pdf_value(const point3& o, const vec3& v) const{
+    double t;
+    vec3 offset;
+    if(!intersect_plane(ray(o, v), 0.001, INFINITY, t, offset)){
+        return 0.0;
+    }
+
+    auto area = M_PI * radius*radius;
+    auto distance_squared = t*t * v.length_squared();
+    auto cosine = fabs(dot(v, normal)) / v.length();
+    return distance_squared / (cosine * area);
+}
+
+vec3 disc::sample_direction(const point3& o, const vec3& u) const{
+    auto r = radius * sqrt(u[0]);
+    auto phi = 2*M_PI*u[1];
+    return center + frame.local(r*cos(phi), r*sin(phi), 0) - o;
+}
+
+#endif
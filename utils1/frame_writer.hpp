@@ -0,0 +1,120 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// name of frame index (>= 0) from a pattern like frame_%04d.ppm. The pattern is not
+// handed to printf: it may hold exactly one %d (with an optional 0 flag and
+// width) and any number of %%, otherwise the result is empty
+inline std::string frame_path(const std::string &pattern, int index){
+    std::string path;
+    int conversions = 0;
+    for(size_t i=0; i<pattern.size(); i++){
+        if(pattern[i] != '%'){
+            path += pattern[i];
+            continue;
+        }
+        if(i + 1 < pattern.size() && pattern[i + 1] == '%'){
+            path += '%';
+            i++;
+            continue;
+        }
+        size_t j = i + 1;
+        bool zero = j < pattern.size() && pattern[j] == '0';
+        if(zero){
+            j++;
+        }
+        int width = 0;
+        while(j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 100){
+            width = width * 10 + (pattern[j++] - '0');
+        }
+        if(j >= pattern.size() || pattern[j] != 'd' || ++conversions > 1){
+            return std::string();
+        }
+        std::string digits = std::to_string(index);
+        if(int(digits.size()) < width){
+            path.append(width - digits.size(), zero ? '0' : ' ');
+        }
+        path += digits;
+        i = j;
+    }
+    return conversions == 1 ? path : std::string();
+}
+
+// Encodes and writes finished frames on its own thread, so frame N is
+// written while N + 1 renders. At most max_queued frames wait; push()
+// blocks beyond that, which keeps memory bounded when the disk is slower
+// than the renderer. Frames are written in the order they are pushed.
+class frame_writer {
+    public:
+        typedef std::function<bool(int index, const std::vector<uint32_t> &argb)> write_fn;
+
+        frame_writer(write_fn w, size_t max_queued = 2) : write(std::move(w)), limit(max_queued) {
+            worker = std::thread([this](){ run(); });
+        }
+
+        ~frame_writer(){
+            finish();
+        }
+
+        void push(int index, std::vector<uint32_t> argb){
+            std::unique_lock<std::mutex> lock(m);
+            room.wait(lock, [&](){ return queue.size() < limit; });
+            queue.emplace_back(index, std::move(argb));
+            ready.notify_one();
+        }
+
+        // writes what is queued and stops the thread, false if any write failed
+        bool finish(){
+            {
+                std::lock_guard<std::mutex> lock(m);
+                closed = true;
+            }
+            ready.notify_one();
+            if(worker.joinable()){
+                worker.join();
+            }
+            return ok;
+        }
+
+    private:
+        void run(){
+            for(;;){
+                std::pair<int, std::vector<uint32_t>> frame;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    ready.wait(lock, [&](){ return closed || !queue.empty(); });
+                    if(queue.empty()){
+                        return;
+                    }
+                    frame = std::move(queue.front());
+                    queue.pop_front();
+                }
+                room.notify_one();
+                if(!write(frame.first, frame.second)){
+                    ok = false;
+                }
+            }
+        }
+
+    private:
+        write_fn write;
+        size_t limit;
+        std::deque<std::pair<int, std::vector<uint32_t>>> queue;
+        bool closed = false;
+        bool ok = true;
+        std::mutex m;
+        std::condition_variable ready;
+        std::condition_variable room;
+        std::thread worker;
+};
+
+#endif
@@ -9,7 +9,7 @@ void set_seed(int seed){
 }
 
 double random_double(){
-	return double(rand())/ (RAND_MAX + 1);
+	return double(rand())/ (RAND_MAX + 1.0);
 }
 
 double random(double min, double max){
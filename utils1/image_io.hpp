@@ -0,0 +1,231 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "tonemap.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// binary PPM from ARGB8888 pixels
+inline bool write_ppm(const std::string &path, const uint32_t *argb, int width, int height){
+    FILE *f = fopen(path.c_str(), "wb");
+    if(f == NULL){
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(size_t(width) * 3);
+    for(int y=0; y<height; y++){
+        for(int x=0; x<width; x++){
+            uint32_t p = argb[size_t(y) * width + x];
+            row[3*x] = uint8_t(p >> 16);
+            row[3*x + 1] = uint8_t(p >> 8);
+            row[3*x + 2] = uint8_t(p);
+        }
+        fwrite(row.data(), 1, row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// linear radiance as a little-endian PFM, which stores rows bottom to top
+inline bool write_pfm(const std::string &path, const accum_buffer &film){
+    FILE *f = fopen(path.c_str(), "wb");
+    if(f == NULL){
+        return false;
+    }
+    fprintf(f, "PF\n%d %d\n-1.0\n", film.width, film.height);
+    std::vector<float> row(size_t(film.width) * 3);
+    for(int y=film.height-1; y>=0; y--){
+        for(int x=0; x<film.width; x++){
+            size_t p = size_t(y) * film.width + x;
+            row[3*x] = film.r[p];
+            row[3*x + 1] = film.g[p];
+            row[3*x + 2] = film.b[p];
+        }
+        fwrite(row.data(), sizeof(float), row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// YUV4MPEG2 stream, 4:2:0 with full-range BT.601 like JPEG; odd sizes keep
+// the last chroma sample for the half-covered edge
+class y4m_writer {
+    public:
+        y4m_writer(const std::string &path, int w, int h, int fps) : width(w), height(h) {
+            file = fopen(path.c_str(), "wb");
+            if(file != NULL){
+                fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", w, h, fps);
+            }
+        }
+
+        ~y4m_writer(){
+            close();
+        }
+
+        bool is_open() const {return file != NULL; }
+
+        bool write_frame(const uint32_t *argb);
+
+        bool close(){
+            bool ok = file != NULL && fclose(file) == 0;
+            file = NULL;
+            return ok;
+        }
+
+    public:
+        const int width;
+        const int height;
+
+    private:
+        FILE *file = NULL;
+        std::vector<uint8_t> plane;
+};
+
+bool y4m_writer::write_frame(const uint32_t *argb){
+    if(file == NULL){
+        return false;
+    }
+    auto clamp8 = [](double v){ return uint8_t(std::min(std::max(v + 0.5, 0.0), 255.0)); };
+    auto channel = [&](int x, int y, int shift){ return double((argb[size_t(y) * width + x] >> shift) & 0xff); };
+
+    fputs("FRAME\n", file);
+    plane.resize(size_t(width) * height);
+    for(int y=0; y<height; y++){
+        for(int x=0; x<width; x++){
+            plane[size_t(y) * width + x] = clamp8(0.299 * channel(x, y, 16) + 0.587 * channel(x, y, 8) + 0.114 * channel(x, y, 0));
+        }
+    }
+    fwrite(plane.data(), 1, plane.size(), file);
+
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    std::vector<uint8_t> cr(size_t(cw) * ch);
+    plane.resize(size_t(cw) * ch);
+    for(int y=0; y<ch; y++){
+        for(int x=0; x<cw; x++){
+            double r = 0, g = 0, b = 0;
+            for(int k=0; k<4; k++){
+                int px = std::min(2*x + (k & 1), width - 1);
+                int py = std::min(2*y + (k >> 1), height - 1);
+                r += channel(px, py, 16);
+                g += channel(px, py, 8);
+                b += channel(px, py, 0);
+            }
+            r /= 4; g /= 4; b /= 4;
+            plane[size_t(y) * cw + x] = clamp8(128 - 0.168736 * r - 0.331264 * g + 0.5 * b);
+            cr[size_t(y) * cw + x] = clamp8(128 + 0.5 * r - 0.418688 * g - 0.081312 * b);
+        }
+    }
+    fwrite(plane.data(), 1, plane.size(), file);
+    return fwrite(cr.data(), 1, cr.size(), file) == cr.size();
+}
+
+inline int seek_to(FILE *f, int64_t offset){
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, off_t(offset), SEEK_SET);
+#endif
+}
+
+// Float image stored as square tiles, for images too large to hold in
+// memory. A 64 byte text header "TPF <width> <height> <tile> -1.0" (the scale
+// marks little-endian floats like PFM) is followed by the tiles in row-major
+// order. Each tile is tile x tile pixels of r, g, b floats, top row first,
+// zero padded past the image edge, so every tile sits at a fixed offset and
+// tiles can be written in any order as they finish.
+const int TILED_HEADER = 64;
+
+class tiled_image_writer {
+    public:
+        tiled_image_writer(const std::string &path, int w, int h, int tile_size)
+            : width(w), height(h), tile(tile_size), tiles_x((w + tile_size - 1) / tile_size), tiles_y((h + tile_size - 1) / tile_size) {
+            file = fopen(path.c_str(), "wb");
+            if(file != NULL){
+                char header[TILED_HEADER];
+                memset(header, ' ', sizeof(header));
+                int n = snprintf(header, sizeof(header), "TPF %d %d %d -1.0", w, h, tile_size);
+                header[n] = ' ';
+                header[TILED_HEADER - 1] = '\n';
+                fwrite(header, 1, sizeof(header), file);
+            }
+        }
+
+        ~tiled_image_writer(){
+            close();
+        }
+
+        bool is_open() const {return file != NULL; }
+
+        // tile (tx, ty) from tile * tile * 3 floats, safe to call from several threads
+        bool write_tile(int tx, int ty, const float *rgb){
+            size_t count = size_t(tile) * tile * 3;
+            int64_t offset = TILED_HEADER + (int64_t(ty) * tiles_x + tx) * int64_t(count * sizeof(float));
+            std::lock_guard<std::mutex> lock(m);
+            return file != NULL && seek_to(file, offset) == 0 && fwrite(rgb, sizeof(float), count, file) == count;
+        }
+
+        bool close(){
+            bool ok = file != NULL && fclose(file) == 0;
+            file = NULL;
+            return ok;
+        }
+
+    public:
+        const int width;
+        const int height;
+        const int tile;
+        const int tiles_x;
+        const int tiles_y;
+
+    private:
+        FILE *file = NULL;
+        std::mutex m;
+};
+
+// converts a tiled image to a plain PFM holding one row of tiles at a time
+inline bool tiled_to_pfm(const std::string &in_path, const std::string &out_path){
+    FILE *in = fopen(in_path.c_str(), "rb");
+    if(in == NULL){
+        return false;
+    }
+    char header[TILED_HEADER + 1] = {0};
+    int w = 0, h = 0, tile = 0;
+    if(fread(header, 1, TILED_HEADER, in) != TILED_HEADER || sscanf(header, "TPF %d %d %d", &w, &h, &tile) != 3 || w <= 0 || h <= 0 || tile <= 0){
+        fclose(in);
+        return false;
+    }
+    FILE *out = fopen(out_path.c_str(), "wb");
+    if(out == NULL){
+        fclose(in);
+        return false;
+    }
+    fprintf(out, "PF\n%d %d\n-1.0\n", w, h);
+
+    int tiles_x = (w + tile - 1) / tile;
+    int tiles_y = (h + tile - 1) / tile;
+    size_t tile_floats = size_t(tile) * tile * 3;
+    std::vector<float> band(tile_floats * tiles_x);
+    std::vector<float> row(size_t(w) * 3);
+    bool ok = true;
+    // PFM rows go bottom to top
+    for(int ty=tiles_y-1; ty>=0 && ok; ty--){
+        ok = seek_to(in, TILED_HEADER + int64_t(ty) * tiles_x * int64_t(tile_floats * sizeof(float))) == 0
+            && fread(band.data(), sizeof(float), band.size(), in) == band.size();
+        for(int y=std::min(tile, h - ty * tile)-1; y>=0 && ok; y--){
+            for(int x=0; x<w; x++){
+                const float *p = band.data() + (x / tile) * tile_floats + (size_t(y) * tile + x % tile) * 3;
+                row[3*x] = p[0];
+                row[3*x + 1] = p[1];
+                row[3*x + 2] = p[2];
+            }
+            ok = fwrite(row.data(), sizeof(float), row.size(), out) == row.size();
+        }
+    }
+    fclose(in);
+    return fclose(out) == 0 && ok;
+}
+
+#endif
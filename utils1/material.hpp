@@ -5,43 +5,139 @@
 #include "vec3.hpp"
 #include "hittable.hpp"
 #include "ray.hpp"
+#include "onb.hpp"
+#include "texture.hpp"
+#include <memory>
 
 class material {
     public:
-        virtual bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const = 0;
+        // u holds three uniform [0,1) samples: two for the direction, one for lobe choice
+        virtual bool scatter(const ray &r_in, const hit_record &rec, const vec3 &u, color &attenuation, ray &scattered) const = 0;
+
+        virtual color emitted(const ray &r_in, const hit_record &rec) const {
+            return color(0, 0, 0);
+        }
+
+        // non-specular materials expose their BSDF to next-event estimation:
+        // eval returns f*cos for direction dir, pdf its sampling density in scatter
+        virtual bool is_specular() const {return true;}
+
+        // 0 for a mirror up to 1 for a fully diffuse surface, widens texture footprints after a bounce
+        virtual double roughness() const {return 0.0;}
+
+        virtual color eval(const ray &r_in, const hit_record &rec, const vec3 &dir) const {
+            return color(0, 0, 0);
+        }
+
+        virtual double pdf(const ray &r_in, const hit_record &rec, const vec3 &dir) const {
+            return 0.0;
+        }
 };
 
 class lambertian : public material{
     public:
         lambertian(const color &c) : al(c) {}
+        // albedo read from t at the hit's (u, v)
+        lambertian(std::shared_ptr<texture> t) : al(1, 1, 1), tex(t) {}
 
-        virtual bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override{
-            auto scatter_dir = rec.normal + random_unit_vector();
-            scattered = ray(rec.p, scatter_dir);
-            if(scatter_dir.near_zero()){
-                scatter_dir = rec.normal;
-            }
-            attenuation = al;
+        virtual bool scatter(const ray &r_in, const hit_record &rec, const vec3 &u, color &attenuation, ray &scattered) const override{
+            onb uvw(rec.normal);
+            scattered = ray(rec.p, uvw.local(sample_cosine_hemisphere(u[0], u[1])));
+            attenuation = albedo(rec);
             return true;
         }
 
+        virtual bool is_specular() const override {return false;}
+        virtual double roughness() const override {return 1.0;}
+
+        virtual color eval(const ray &r_in, const hit_record &rec, const vec3 &dir) const override{
+            auto cosine = dot(rec.normal, unit_vector(dir));
+            return cosine > 0 ? albedo(rec) * (cosine / M_PI) : color(0, 0, 0);
+        }
+
+        virtual double pdf(const ray &r_in, const hit_record &rec, const vec3 &dir) const override{
+            auto cosine = dot(rec.normal, unit_vector(dir));
+            return cosine > 0 ? cosine / M_PI : 0.0;
+        }
+
+    private:
+        color albedo(const hit_record &rec) const {
+            return tex ? tex->value(rec.u, rec.v) : al;
+        }
+
     public:
         color al;
+        std::shared_ptr<texture> tex;
 };
 
 class metal : public material{
     public:
         metal(const color &c, double f) : al(c), fuzz(f < 1 ? f : 1) {}
+        metal(std::shared_ptr<texture> t, double f) : al(1, 1, 1), tex(t), fuzz(f < 1 ? f : 1) {}
+
+        // fuzz is used as the GGX roughness, sampled through the microfacet normal
+        virtual bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const override{
+            vec3 unit_direction = normalised(r_in.direction());
+            if(is_specular()){
+                scattered = ray(rec.p, reflect(unit_direction, rec.normal));
+                attenuation = albedo(rec);
+                return dot(scattered.direction(), rec.normal) > 0;
+            }
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override{
-            vec3 reflected = reflect(normalised(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
-            attenuation = al;
-            return dot(scattered.direction(), rec.normal) > 0;
+            onb uvw(rec.normal);
+            vec3 m = uvw.local(sample_ggx_normal(alpha(), u[0], u[1]));
+            vec3 reflected = reflect(unit_direction, m);
+            auto cos_o = dot(-unit_direction, rec.normal);
+            auto cos_i = dot(reflected, rec.normal);
+            if(cos_o <= 0 || cos_i <= 0){
+                return false;
+            }
+
+            // f*cos/pdf for half-vector sampling
+            auto cos_m = dot(m, rec.normal);
+            auto g = ggx_g1(alpha(), cos_o) * ggx_g1(alpha(), cos_i);
+            scattered = ray(rec.p, reflected);
+            attenuation = albedo(rec) * (g * dot(-unit_direction, m) / (cos_o * cos_m));
+            return true;
+        }
+
+        virtual bool is_specular() const override {return fuzz <= 0.001;}
+        virtual double roughness() const override {return fuzz;}
+
+        virtual color eval(const ray &r_in, const hit_record &rec, const vec3 &dir) const override{
+            vec3 wo = -unit_vector(r_in.direction());
+            vec3 wi = unit_vector(dir);
+            auto cos_o = dot(wo, rec.normal);
+            auto cos_i = dot(wi, rec.normal);
+            if(cos_o <= 0 || cos_i <= 0){
+                return color(0, 0, 0);
+            }
+            vec3 m = unit_vector(wo + wi);
+            auto g = ggx_g1(alpha(), cos_o) * ggx_g1(alpha(), cos_i);
+            return albedo(rec) * (ggx_d(alpha(), dot(m, rec.normal)) * g / (4 * cos_o));
+        }
+
+        virtual double pdf(const ray &r_in, const hit_record &rec, const vec3 &dir) const override{
+            vec3 wo = -unit_vector(r_in.direction());
+            vec3 wi = unit_vector(dir);
+            if(dot(wo, rec.normal) <= 0 || dot(wi, rec.normal) <= 0){
+                return 0.0;
+            }
+            vec3 m = unit_vector(wo + wi);
+            auto cos_m = dot(m, rec.normal);
+            return ggx_d(alpha(), cos_m) * cos_m / (4 * dot(wo, m));
+        }
+
+    private:
+        double alpha() const {return fuzz; }
+
+        color albedo(const hit_record &rec) const {
+            return tex ? tex->value(rec.u, rec.v) : al;
         }
 
     public:
         color al;
+        std::shared_ptr<texture> tex;
         double fuzz;
 };
 
@@ -49,7 +145,7 @@ class dielectric : public material{
     public:
         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override{
+        virtual bool scatter(const ray& r_in, const hit_record& rec, const vec3& u, color& attenuation, ray& scattered) const override{
             attenuation = color(1.0, 1.0, 1.0);
             double refraction_ratio = !rec.front_face ? (1.0/ir) : ir;
 
@@ -60,7 +156,7 @@ class dielectric : public material{
             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
             vec3 direction;
 
-            if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()){
+            if(cannot_refract || reflectance(cos_theta, refraction_ratio) > u[2]){
                 direction = reflect(unit_direction, rec.normal);
             }
             else{
@@ -82,4 +178,21 @@ class dielectric : public material{
         }
 };
 
+class diffuse_light : public material{
+    public:
+        diffuse_light(const color &c) : emit(c) {}
+
+        virtual bool scatter(const ray &r_in, const hit_record &rec, const vec3 &u, color &attenuation, ray &scattered) const override{
+            return false;
+        }
+
+        // two-sided, triangles do not keep a consistent outward side
+        virtual color emitted(const ray &r_in, const hit_record &rec) const override{
+            return emit;
+        }
+
+    public:
+        color emit;
+};
+
 #endif
\ No newline at end of file
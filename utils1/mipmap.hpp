@@ -0,0 +1,183 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "vec3.hpp"
+
+// An 8 bit RGB texture kept as a chain of box filtered levels, each stored in
+// 8x8 texel tiles of 256 bytes rather than in rows. A lookup and its
+// neighbours then touch one or two tiles instead of one row each, and a
+// lookup on a coarse level touches a few kilobytes instead of the whole
+// image. Texels are packed as r | g << 8 | b << 16.
+// u wraps around, v is clamped to the edge.
+
+// index() hardcodes this size
+const int MIP_TILE = 8;
+
+struct mip_level {
+    int width;
+    int height;
+    int tiles_x;
+    std::vector<uint32_t> texels;
+
+    // x and y are never negative, so the tile split is shifts and masks
+    size_t index(int x, int y) const {
+        return ((size_t(y >> 3) * tiles_x + (x >> 3)) << 6) + ((y & 7) << 3) + (x & 7);
+    }
+
+    uint32_t at(int x, int y) const {return texels[index(x, y)]; }
+};
+
+inline color unpack_texel(uint32_t t){
+    return color((t & 0xff) / 255.0, (t >> 8 & 0xff) / 255.0, (t >> 16 & 0xff) / 255.0);
+}
+
+// channels as 0..255, for filtering before the one division in unpack
+inline color texel_bytes(uint32_t t){
+    return color(double(t & 0xff), double(t >> 8 & 0xff), double(t >> 16 & 0xff));
+}
+
+inline uint32_t pack_texel(int r, int g, int b){
+    return uint32_t(r) | uint32_t(g) << 8 | uint32_t(b) << 16;
+}
+
+class mip_texture {
+    public:
+        mip_texture() {}
+        // rows of w packed texels, top row first
+        mip_texture(const uint32_t *rows, int w, int h) {build(rows, w, h); }
+
+        void build(const uint32_t *rows, int w, int h);
+
+        bool empty() const {return levels.empty(); }
+        int width() const {return levels.empty() ? 0 : levels[0].width; }
+        int height() const {return levels.empty() ? 0 : levels[0].height; }
+
+        // level whose texels are about footprint wide, footprint in texels of level 0
+        double level_of(double footprint) const {
+            return footprint > 1 ? std::min(std::log2(footprint), double(levels.size() - 1)) : 0.0;
+        }
+
+        // nearest texel of one level
+        color nearest(double u, double v, int level) const;
+        // bilinear on one level
+        color bilinear(double u, double v, int level) const;
+        // point sampled at level 0 while the footprint is below a texel, so the
+        // full resolution image stays sharp; trilinear between levels above that
+        color sample(double u, double v, double footprint) const;
+
+        size_t memory() const;
+
+    public:
+        std::vector<mip_level> levels;
+
+    private:
+        // only taken for coordinates off the edge
+        static int wrap(int x, int w) {x %= w; return x < 0 ? x + w : x; }
+};
+
+void mip_texture::build(const uint32_t *rows, int w, int h){
+    levels.clear();
+    if(rows == nullptr || w <= 0 || h <= 0){
+        return;
+    }
+
+    auto make_level = [](int lw, int lh){
+        mip_level l;
+        l.width = lw;
+        l.height = lh;
+        l.tiles_x = (lw + MIP_TILE - 1) / MIP_TILE;
+        int tiles_y = (lh + MIP_TILE - 1) / MIP_TILE;
+        l.texels.assign(size_t(l.tiles_x) * tiles_y * MIP_TILE * MIP_TILE, 0);
+        return l;
+    };
+
+    levels.push_back(make_level(w, h));
+    for(int y=0; y<h; y++){
+        for(int x=0; x<w; x++){
+            levels[0].texels[levels[0].index(x, y)] = rows[size_t(y) * w + x];
+        }
+    }
+
+    // 2x2 box filter; an odd last row or column is folded into its neighbour
+    while(levels.back().width > 1 || levels.back().height > 1){
+        const mip_level &src = levels.back();
+        mip_level dst = make_level(std::max(1, src.width / 2), std::max(1, src.height / 2));
+        for(int y=0; y<dst.height; y++){
+            int y0 = 2 * y, y1 = (y == dst.height - 1) ? src.height : std::min(2 * y + 2, src.height);
+            for(int x=0; x<dst.width; x++){
+                int x0 = 2 * x, x1 = (x == dst.width - 1) ? src.width : std::min(2 * x + 2, src.width);
+                int r = 0, g = 0, b = 0, n = 0;
+                for(int sy=y0; sy<y1; sy++){
+                    for(int sx=x0; sx<x1; sx++){
+                        uint32_t t = src.at(sx, sy);
+                        r += t & 0xff;
+                        g += t >> 8 & 0xff;
+                        b += t >> 16 & 0xff;
+                        n++;
+                    }
+                }
+                dst.texels[dst.index(x, y)] = pack_texel((r + n/2) / n, (g + n/2) / n, (b + n/2) / n);
+            }
+        }
+        levels.push_back(std::move(dst));
+    }
+}
+
+color mip_texture::nearest(double u, double v, int level) const{
+    const mip_level &l = levels[level];
+    double fx = u * l.width;
+    int x = int(fx);
+    if(fx < 0 || x >= l.width){
+        x = wrap(int(std::floor(fx)), l.width);
+    }
+    int y = std::clamp(int(v * l.height), 0, l.height - 1);
+    return unpack_texel(l.at(x, y));
+}
+
+color mip_texture::bilinear(double u, double v, int level) const{
+    const mip_level &l = levels[level];
+    double fx = u * l.width - 0.5;
+    double fy = v * l.height - 0.5;
+    int x0 = int(fx + 1) - 1;
+    int y0 = int(fy + 1) - 1;
+    double ax = fx - x0;
+    double ay = fy - y0;
+    int xa = x0, xb = x0 + 1;
+    if(xa < 0 || xb >= l.width){
+        xa = wrap(xa, l.width);
+        xb = wrap(xb, l.width);
+    }
+    int ya = std::clamp(y0, 0, l.height - 1), yb = std::clamp(y0 + 1, 0, l.height - 1);
+
+    color top = (1 - ax) * texel_bytes(l.at(xa, ya)) + ax * texel_bytes(l.at(xb, ya));
+    color bottom = (1 - ax) * texel_bytes(l.at(xa, yb)) + ax * texel_bytes(l.at(xb, yb));
+    return ((1 - ay) * top + ay * bottom) / 255.0;
+}
+
+color mip_texture::sample(double u, double v, double footprint) const{
+    double lod = level_of(footprint);
+    if(lod <= 0){
+        return nearest(u, v, 0);
+    }
+    int l0 = int(lod);
+    double a = lod - l0;
+    color c = bilinear(u, v, l0);
+    if(a > 0 && l0 + 1 < int(levels.size())){
+        c = (1 - a) * c + a * bilinear(u, v, l0 + 1);
+    }
+    return c;
+}
+
+size_t mip_texture::memory() const{
+    size_t bytes = 0;
+    for(const mip_level &l : levels){
+        bytes += l.texels.size() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef NET_H
+#define NET_H
+
+// minimal blocking TCP over winsock or POSIX sockets, link with -lws2_32 on windows
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+const socket_t INVALID_SOCK = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+const socket_t INVALID_SOCK = -1;
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// a dead peer should fail the send, not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+inline bool net_init(){
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return true;
+#endif
+}
+
+inline void close_socket(socket_t s){
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+// listens on one IPv4 address; loopback keeps the port private to this machine,
+// 0.0.0.0 opens it on every interface for workers on other machines
+inline socket_t tcp_listen(int port, const std::string &address = "127.0.0.1"){
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(uint16_t(port));
+    if(inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1){
+        return INVALID_SOCK;
+    }
+
+    socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s == INVALID_SOCK){
+        return INVALID_SOCK;
+    }
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+    if(bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0){
+        close_socket(s);
+        return INVALID_SOCK;
+    }
+    return s;
+}
+
+inline socket_t tcp_accept(socket_t listener){
+    socket_t s = accept(listener, NULL, NULL);
+    if(s != INVALID_SOCK){
+        int yes = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+    }
+    return s;
+}
+
+inline socket_t tcp_connect(const std::string &host, int port){
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = NULL;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0){
+        return INVALID_SOCK;
+    }
+
+    socket_t s = INVALID_SOCK;
+    for(addrinfo *a = res; a != NULL; a = a->ai_next){
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(s == INVALID_SOCK){
+            continue;
+        }
+        if(connect(s, a->ai_addr, int(a->ai_addrlen)) == 0){
+            break;
+        }
+        close_socket(s);
+        s = INVALID_SOCK;
+    }
+    freeaddrinfo(res);
+
+    if(s != INVALID_SOCK){
+        int yes = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+    }
+    return s;
+}
+
+inline bool send_all(socket_t s, const void *data, size_t size){
+    const char *p = (const char*)data;
+    while(size > 0){
+        int n = int(send(s, p, int(size > (1 << 20) ? (1 << 20) : size), SEND_FLAGS));
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+// false when the peer closed the connection or the read failed
+inline bool recv_all(socket_t s, void *data, size_t size){
+    char *p = (char*)data;
+    while(size > 0){
+        int n = int(recv(s, p, int(size > (1 << 20) ? (1 << 20) : size), 0));
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+// one read of at most size bytes, which does not block once the socket is readable;
+// 0 or less when the peer closed the connection or the read failed
+inline int recv_some(socket_t s, void *data, size_t size){
+    return int(recv(s, (char*)data, int(size), 0));
+}
+
+// a blocking read that waits longer than this fails instead
+inline void set_recv_timeout(socket_t s, int timeout_ms){
+#ifdef _WIN32
+    DWORD tv = DWORD(timeout_ms);
+#else
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+}
+
+// waits until some of the sockets can be read; ready[i] is set for those, returns how many
+inline int wait_readable(const std::vector<socket_t> &sockets, int timeout_ms, std::vector<bool> &ready){
+    fd_set set;
+    FD_ZERO(&set);
+    socket_t top = 0;
+    for(socket_t s : sockets){
+        FD_SET(s, &set);
+        if(s > top){
+            top = s;
+        }
+    }
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int n = select(int(top + 1), &set, NULL, NULL, &tv);
+    ready.assign(sockets.size(), false);
+    for(size_t i=0; i<sockets.size() && n > 0; i++){
+        ready[i] = FD_ISSET(sockets[i], &set) != 0;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef PACKED_BVH_H
+#define PACKED_BVH_H
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "material.hpp"
+#include "wide_bvh.hpp"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// 20 bytes against 72 for a sphere object and the pointer to it in the object list
+struct sphere_record {
+    float center[3];
+    float radius;
+    uint32_t material;
+};
+
+// corner and the two edges from it, 44 bytes; the normal is only needed for
+// the closest hit and is rebuilt from the edges then
+struct triangle_record {
+    float p0[3];
+    float e1[3];
+    float e2[3];
+    uint32_t material;
+    // index into the texture coordinates, NO_UV for a triangle without them
+    uint32_t uv;
+};
+
+const uint32_t NO_UV = ~uint32_t(0);
+
+// texture coordinates (u, v) of the three corners
+struct triangle_uv {
+    float uv[3][2];
+};
+
+inline vec3 load3(const float *f){
+    return vec3(f[0], f[1], f[2]);
+}
+
+// Static scene of spheres and triangles packed into flat arrays, so a leaf
+// is an index into a record array instead of a pointer to a separately
+// allocated object behind a virtual call. Materials are shared through a
+// table and referenced by 32-bit index. Geometry is stored in float and
+// intersected in double. The tree is the quantized 4-wide one of wide_bvh,
+// one 64 byte node per four children where the binary bvh reads a 64 byte
+// node per child. Anything else (quads, discs, planes, instances, lists) is
+// kept in an ordinary bvh next to it. Objects are copied in, so later changes
+// to the originals are not seen; dynamic scenes keep using bvh.
+class packed_bvh : public hittable {
+    public:
+        packed_bvh(const std::vector<shared_ptr<hittable>>& list);
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        // bytes used by records, texture coordinates, the material table and nodes
+        size_t memory() const {
+            return spheres.size() * sizeof(sphere_record) + triangles.size() * sizeof(triangle_record)
+                + uvs.size() * sizeof(triangle_uv) + materials.size() * sizeof(shared_ptr<material>)
+                + nodes.size() * sizeof(bvh4_node);
+        }
+
+    public:
+        std::vector<sphere_record> spheres;
+        std::vector<triangle_record> triangles;
+        std::vector<triangle_uv> uvs;
+        std::vector<shared_ptr<material>> materials;
+        std::vector<bvh4_node> nodes;
+        aabb root_box;
+        bvh rest;
+
+    private:
+        static const int STACK_SIZE = 128;
+
+        // prims [0, spheres) are spheres, the triangles follow
+        bool intersect_prim(int prim, const ray& r, double t_min, double t_max, double &t, double &u, double &v) const;
+        bool intersect_from(int start, const ray& r, const wide_bvh::ray4& r4, double t_min, double& closest, hit_record& rec) const;
+        bool occluded_from(int start, const ray& r, const wide_bvh::ray4& r4, double t_min, double t_max) const;
+};
+
+packed_bvh::packed_bvh(const std::vector<shared_ptr<hittable>>& list){
+    std::unordered_map<const material*, uint32_t> material_index;
+    auto index_of = [&](const shared_ptr<material> &m){
+        auto it = material_index.find(m.get());
+        if(it != material_index.end()){
+            return it->second;
+        }
+        uint32_t i = uint32_t(materials.size());
+        materials.push_back(m);
+        material_index[m.get()] = i;
+        return i;
+    };
+
+    std::vector<shared_ptr<hittable>> others;
+    for(const auto &object : list){
+        if(auto s = dynamic_cast<const sphere*>(object.get())){
+            spheres.push_back({{float(s->center.x()), float(s->center.y()), float(s->center.z())}, float(s->radius), index_of(s->mat_ptr)});
+        }
+        else if(auto t = dynamic_cast<const triangle*>(object.get())){
+            uint32_t uv = NO_UV;
+            if(t->mapped){
+                uv = uint32_t(uvs.size());
+                uvs.push_back({{{t->uv[0][0], t->uv[0][1]}, {t->uv[1][0], t->uv[1][1]}, {t->uv[2][0], t->uv[2][1]}}});
+            }
+            triangles.push_back({{float(t->p0.x()), float(t->p0.y()), float(t->p0.z())},
+                                 {float(t->e1.x()), float(t->e1.y()), float(t->e1.z())},
+                                 {float(t->e2.x()), float(t->e2.y()), float(t->e2.z())}, index_of(t->mat_ptr), uv});
+        }
+        else{
+            others.push_back(object);
+        }
+    }
+    rest = bvh(others);
+
+    // boxes from the stored floats, so they bound exactly what is intersected
+    std::vector<std::pair<int, aabb>> items;
+    items.reserve(spheres.size() + triangles.size());
+    for(const auto &s : spheres){
+        vec3 r(s.radius, s.radius, s.radius);
+        items.push_back({int(items.size()), aabb(load3(s.center) - r, load3(s.center) + r)});
+    }
+    for(const auto &t : triangles){
+        point3 p0 = load3(t.p0);
+        aabb box;
+        box.expand(p0);
+        box.expand(p0 + load3(t.e1));
+        box.expand(p0 + load3(t.e2));
+        items.push_back({int(items.size()), box});
+    }
+    std::vector<bvh_node> binary;
+    int root = bvh::build_nodes(std::move(items), binary);
+    if(root >= 0){
+        root_box = binary[root].box;
+    }
+    wide_bvh::collapse_nodes(binary, root, nodes);
+}
+
+bool packed_bvh::intersect_prim(int prim, const ray& r, double t_min, double t_max, double &t, double &u, double &v) const{
+    if(prim < int(spheres.size())){
+        const sphere_record &s = spheres[prim];
+        vec3 oc = r.origin() - load3(s.center);
+        double radius = s.radius;
+        auto a = r.direction().length_squared();
+        auto b_h = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius*radius;
+        auto discriminant = b_h*b_h - a*c;
+        if(discriminant < 0){
+            return false;
+        }
+        // same scaled comparisons as sphere::intersect, one division for the hit
+        auto sqrtd = sqrt(discriminant);
+        auto t_min_a = t_min * a;
+        auto t_max_a = t_max * a;
+        auto pseudo_root = -b_h - sqrtd;
+        if(pseudo_root < t_min_a || t_max_a < pseudo_root){
+            pseudo_root = -b_h + sqrtd;
+            if(pseudo_root < t_min_a || t_max_a < pseudo_root){
+                return false;
+            }
+        }
+        t = pseudo_root / a;
+        return true;
+    }
+
+    const triangle_record &tri = triangles[prim - spheres.size()];
+    return intersect_triangle(r, load3(tri.p0), load3(tri.e1), load3(tri.e2), t_min, t_max, t, u, v);
+}
+
+void packed_bvh::finalize(const ray& r, hit_record& rec) const{
+    rec.p = r.at(rec.t);
+    if(rec.prim < int(spheres.size())){
+        const sphere_record &s = spheres[rec.prim];
+        vec3 outward_normal = (rec.p - load3(s.center)) / s.radius;
+        rec.set_face_normal(r, outward_normal);
+        sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat_ptr = materials[s.material];
+        return;
+    }
+    // same orientation as triangle::finalize
+    const triangle_record &tri = triangles[rec.prim - spheres.size()];
+    vec3 normal = unit_vector(cross(load3(tri.e1), load3(tri.e2)));
+    rec.set_face_normal(r, dot(r.direction(), normal) > 0 ? normal : -normal);
+    if(tri.uv != NO_UV){
+        const float (&uv)[3][2] = uvs[tri.uv].uv;
+        double w = 1 - rec.u - rec.v;
+        double u = w * uv[0][0] + rec.u * uv[1][0] + rec.v * uv[2][0];
+        rec.v = w * uv[0][1] + rec.u * uv[1][1] + rec.v * uv[2][1];
+        rec.u = u;
+    }
+    rec.mat_ptr = materials[tri.material];
+}
+
+// the loops of wide_bvh, with leaves looked up in the record arrays
+bool packed_bvh::intersect_from(int start, const ray& r, const wide_bvh::ray4& r4, double t_min, double& closest, hit_record& rec) const{
+    bool hit_anything = false;
+    int stack[STACK_SIZE];
+    float stack_dist[STACK_SIZE];
+    int top = 0;
+    stack[top] = start;
+    stack_dist[top++] = float(t_min);
+
+    auto leaf = [&](int prim){
+        double t, u, v;
+        if(intersect_prim(prim, r, t_min, closest, t, u, v)){
+            hit_anything = true;
+            closest = t;
+            rec.t = t;
+            rec.u = u;
+            rec.v = v;
+            rec.obj = this;
+            rec.prim = prim;
+        }
+    };
+
+    while(top > 0){
+        top--;
+        int entry = stack[top];
+        if(stack_dist[top] > float(closest) * 1.0000004f){
+            continue;
+        }
+        if(entry < 0){
+            leaf(~entry);
+            continue;
+        }
+
+        const bvh4_node &n = nodes[entry];
+        float dist[4];
+        int mask = wide_bvh::intersect_node(n, r4, float(t_min), float(closest), dist);
+
+        // insertion sort, farthest first on the stack so the nearest pops next
+        int order[4];
+        int k = 0;
+        for(int c=0; c<4; c++){
+            if(mask & (1 << c)){
+                int j = k++;
+                while(j > 0 && dist[order[j-1]] < dist[c]){
+                    order[j] = order[j-1];
+                    j--;
+                }
+                order[j] = c;
+            }
+        }
+        for(int i=0; i<k; i++){
+            int c = order[i];
+            if(top < STACK_SIZE){
+                stack[top] = n.child[c];
+                stack_dist[top++] = dist[c];
+            }
+            else if(n.child[c] < 0){
+                leaf(~n.child[c]);
+            }
+            else{
+                hit_anything |= intersect_from(n.child[c], r, r4, t_min, closest, rec);
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+bool packed_bvh::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    bool hit_anything = false;
+    auto closest = t_max;
+
+    if(!nodes.empty()){
+        // rays missing the whole tree, most of them in small scenes, skip the node tests
+        vec3 d = r.direction();
+        vec3 inv_dir(1/d.x(), 1/d.y(), 1/d.z());
+        if(box_entry(root_box, r.origin(), inv_dir, t_min, closest) < INFINITY){
+            hit_anything = intersect_from(0, r, wide_bvh::make_ray4(r), t_min, closest, rec);
+        }
+    }
+    if(rest.intersect(r, t_min, closest, rec)){
+        hit_anything = true;
+    }
+
+    return hit_anything;
+}
+
+bool packed_bvh::occluded_from(int start, const ray& r, const wide_bvh::ray4& r4, double t_min, double t_max) const{
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = start;
+
+    double t, u, v;
+    while(top > 0){
+        int entry = stack[--top];
+        if(entry < 0){
+            if(intersect_prim(~entry, r, t_min, t_max, t, u, v)){
+                return true;
+            }
+            continue;
+        }
+
+        const bvh4_node &n = nodes[entry];
+        float dist[4];
+        int mask = wide_bvh::intersect_node(n, r4, float(t_min), float(t_max), dist);
+        for(int c=0; c<4; c++){
+            if(!(mask & (1 << c))){
+                continue;
+            }
+            if(top < STACK_SIZE){
+                stack[top++] = n.child[c];
+            }
+            else if(n.child[c] < 0 ? intersect_prim(~n.child[c], r, t_min, t_max, t, u, v) : occluded_from(n.child[c], r, r4, t_min, t_max)){
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool packed_bvh::occluded(const ray& r, double t_min, double t_max) const{
+    if(rest.occluded(r, t_min, t_max)){
+        return true;
+    }
+    if(nodes.empty()){
+        return false;
+    }
+
+    vec3 d = r.direction();
+    vec3 inv_dir(1/d.x(), 1/d.y(), 1/d.z());
+    return box_entry(root_box, r.origin(), inv_dir, t_min, t_max) < INFINITY && occluded_from(0, r, wide_bvh::make_ray4(r), t_min, t_max);
+}
+
+bool packed_bvh::bounding_box(aabb& output_box) const{
+    aabb rest_box;
+    if(!rest.objects.empty() && !rest.bounding_box(rest_box)){
+        return false;
+    }
+    if(nodes.empty() && rest.objects.empty()){
+        return false;
+    }
+    output_box = rest_box;
+    if(!nodes.empty()){
+        output_box.expand(root_box);
+    }
+    return true;
+}
+
+#endif
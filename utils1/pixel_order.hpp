@@ -0,0 +1,118 @@
+#ifndef PIXEL_ORDER_H
+#define PIXEL_ORDER_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Order in which the image is rendered. Pixels are grouped in square tiles,
+// and both the tiles and the pixels inside a tile follow the chosen curve,
+// so consecutive rays are spatially close and reuse the same bvh nodes and
+// skybox texels. Scanline with tile size 0 is the plain row by row order.
+enum class pixel_curve {scanline, morton, hilbert};
+
+struct pixel_pos {
+    int x;
+    int y;
+};
+
+// keeps the even bits of a morton code
+inline uint32_t compact_bits(uint32_t v){
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0f0f0f0f;
+    v = (v | (v >> 4)) & 0x00ff00ff;
+    v = (v | (v >> 8)) & 0x0000ffff;
+    return v;
+}
+
+inline void morton_decode(uint32_t d, int &x, int &y){
+    x = int(compact_bits(d));
+    y = int(compact_bits(d >> 1));
+}
+
+// d-th point of the hilbert curve over an n x n grid, n a power of two
+inline void hilbert_decode(int n, uint32_t d, int &x, int &y){
+    x = y = 0;
+    for(int s=1; s<n; s*=2){
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if(ry == 0){
+            if(rx == 1){
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+// visits every cell of a w x h grid along the curve, clipping the covering square
+inline std::vector<pixel_pos> curve_order(pixel_curve curve, int w, int h){
+    std::vector<pixel_pos> out;
+    out.reserve(w * h);
+    if(curve == pixel_curve::scanline){
+        for(int y=0; y<h; y++){
+            for(int x=0; x<w; x++){
+                out.push_back({x, y});
+            }
+        }
+        return out;
+    }
+
+    int n = 1;
+    while(n < w || n < h){
+        n *= 2;
+    }
+    for(uint32_t d=0; d<uint32_t(n) * n; d++){
+        int x, y;
+        if(curve == pixel_curve::morton){
+            morton_decode(d, x, y);
+        }
+        else{
+            hilbert_decode(n, d, x, y);
+        }
+        if(x < w && y < h){
+            out.push_back({x, y});
+        }
+    }
+    return out;
+}
+
+inline std::vector<pixel_pos> pixel_order(int width, int height, int tile, pixel_curve curve){
+    if(tile <= 0){
+        return curve_order(curve, width, height);
+    }
+
+    std::vector<pixel_pos> out;
+    out.reserve(width * height);
+    int tiles_x = (width + tile - 1) / tile;
+    int tiles_y = (height + tile - 1) / tile;
+    std::vector<pixel_pos> inner = curve_order(curve, tile, tile);
+    for(const pixel_pos &t : curve_order(curve, tiles_x, tiles_y)){
+        for(const pixel_pos &q : inner){
+            int x = t.x * tile + q.x;
+            int y = t.y * tile + q.y;
+            if(x < width && y < height){
+                out.push_back({x, y});
+            }
+        }
+    }
+    return out;
+}
+
+inline pixel_curve parse_pixel_curve(const std::string &name){
+    if(name == "morton"){
+        return pixel_curve::morton;
+    }
+    if(name == "hilbert"){
+        return pixel_curve::hilbert;
+    }
+    return pixel_curve::scanline;
+}
+
+#endif
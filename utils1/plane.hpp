@@ -12,7 +12,10 @@ class plane : public hittable {
         plane() {}
         plane(point3 cen, vec3 n, std::shared_ptr<material> m) : center(cen), normal(n), mat_ptr(m) {};
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual void translate(const vec3& offset) override {center += offset;}
     
 
     public:
@@ -21,16 +24,25 @@ class plane : public hittable {
         std::shared_ptr<material> mat_ptr;
 };
 
-bool plane::hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
+bool plane::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
     auto t = dot(center - r.origin(), normal) / dot(normal, r.direction());
     if(t > t_min &&  t_max > t){
         rec.t = t;
-        rec.p = r.at(rec.t);
-        rec.set_face_normal(r, normal);
-        rec.mat_ptr = mat_ptr;
+        rec.obj = this;
         return true;
     }
     return false;
 }
 
+void plane::finalize(const ray& r, hit_record& rec) const{
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, normal);
+    rec.mat_ptr = mat_ptr;
+}
+
+bool plane::occluded(const ray& r, double t_min, double t_max) const{
+    auto t = dot(center - r.origin(), normal) / dot(normal, r.direction());
+    return t > t_min && t_max > t;
+}
+
 #endif
\ No newline at end of file
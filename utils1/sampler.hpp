@@ -0,0 +1,385 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "functions.hpp"
+#include "vec3.hpp"
+
+// Samplers hand out the dimensions of one pixel sample in a fixed order
+// (pixel jitter, then per bounce: light selection, light position, BSDF),
+// so each consumer sees its own decorrelated stream of [0,1) values.
+
+inline uint32_t reverse_bits(uint32_t x){
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint32_t hash_u32(uint32_t x){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v){
+    return seed ^ (hash_u32(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling through the Laine-Karras hash (Burley 2020)
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed){
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed){
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// first two Sobol dimensions
+inline uint32_t sobol_dim0(uint32_t i){
+    return reverse_bits(i);
+}
+
+inline uint32_t sobol_dim1(uint32_t i){
+    uint32_t v = 1u << 31;
+    uint32_t result = 0;
+    for(; i; i >>= 1, v ^= v >> 1){
+        if(i & 1){
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+inline double to_unit_double(uint32_t x){
+    return x * (1.0 / 4294967296.0);
+}
+
+// Kensler, "Correlated Multi-Jittered Sampling"
+inline uint32_t kensler_permute(uint32_t i, uint32_t l, uint32_t p){
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do{
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while(i >= l);
+    return (i + p) % l;
+}
+
+inline double kensler_randfloat(uint32_t i, uint32_t p){
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10;
+    i *= 0xb36534e5u;
+    i ^= i >> 12;
+    i ^= i >> 21;
+    i *= 0x93fc4795u;
+    i ^= 0xdf6e307fu;
+    i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return to_unit_double(i);
+}
+
+// fixed ids for checkpoints, never renumber them
+enum class sampler_type : uint32_t {independent = 1, stratified = 2, sobol = 3, blue_noise = 4};
+
+class sampler {
+    public:
+        sampler(int spp, uint32_t s) : samples_per_pixel(spp), seed(s) {}
+        virtual ~sampler() {}
+
+        // restart the dimension counter for sample `index` of pixel (x, y)
+        virtual void start_pixel_sample(int x, int y, int index){
+            px = x;
+            py = y;
+            sample_index = uint32_t(index);
+            dimension = 0;
+        }
+
+        virtual double get_1d() = 0;
+        virtual void get_2d(double &u1, double &u2) = 0;
+        virtual std::unique_ptr<sampler> clone() const = 0;
+        virtual sampler_type type() const = 0;
+
+        vec3 get_3d(){
+            vec3 u;
+            get_2d(u[0], u[1]);
+            u[2] = get_1d();
+            return u;
+        }
+
+    protected:
+        uint32_t pixel_seed() const {
+            return hash_combine(hash_combine(hash_combine(seed, uint32_t(px)), uint32_t(py)), dimension);
+        }
+
+    public:
+        int samples_per_pixel;
+        uint32_t seed;
+
+    protected:
+        int px = 0;
+        int py = 0;
+        uint32_t sample_index = 0;
+        uint32_t dimension = 0;
+};
+
+// independent uniform samples, the behaviour before samplers existed
+class independent_sampler : public sampler {
+    public:
+        independent_sampler(int spp, uint32_t s = 0) : sampler(spp, s) {}
+
+        virtual double get_1d() override {
+            dimension++;
+            return random_double();
+        }
+
+        virtual void get_2d(double &u1, double &u2) override {
+            dimension += 2;
+            u1 = random_double();
+            u2 = random_double();
+        }
+
+        virtual sampler_type type() const override {return sampler_type::independent; }
+        virtual std::unique_ptr<sampler> clone() const override {
+            return std::make_unique<independent_sampler>(*this);
+        }
+};
+
+// correlated multi-jittered samples, strata shuffled independently per dimension
+class stratified_sampler : public sampler {
+    public:
+        stratified_sampler(int spp, uint32_t s = 0) : sampler(spp, s) {
+            m = std::max(1, int(sqrt(double(spp))));
+            n = (spp + m - 1) / m;
+        }
+
+        virtual double get_1d() override {
+            uint32_t p = pixel_seed();
+            dimension++;
+            uint32_t count = uint32_t(samples_per_pixel);
+            uint32_t s = kensler_permute(sample_index % count, count, p * 0x68bc21ebu);
+            return (s + kensler_randfloat(sample_index, p * 0x967a889bu)) / count;
+        }
+
+        virtual void get_2d(double &u1, double &u2) override {
+            uint32_t p = pixel_seed();
+            dimension += 2;
+            uint32_t count = uint32_t(m * n);
+            uint32_t s = kensler_permute(sample_index % count, count, p * 0x51633e2du);
+            uint32_t sx = kensler_permute(s % m, m, p * 0xa511e9b3u);
+            uint32_t sy = kensler_permute(s / m, n, p * 0x63d83595u);
+            double jx = kensler_randfloat(s, p * 0xa399d265u);
+            double jy = kensler_randfloat(s, p * 0x711ad6a5u);
+            u1 = std::min((s % m + (sy + jx) / n) / m, 0.9999999999);
+            u2 = std::min((s / m + (sx + jy) / m) / n, 0.9999999999);
+        }
+
+        virtual sampler_type type() const override {return sampler_type::stratified; }
+        virtual std::unique_ptr<sampler> clone() const override {
+            return std::make_unique<stratified_sampler>(*this);
+        }
+
+    private:
+        int m;
+        int n;
+};
+
+// Owen-scrambled Sobol; every dimension pair reuses the first two Sobol
+// dimensions on an independently shuffled index (Burley 2020 padding)
+class sobol_sampler : public sampler {
+    public:
+        sobol_sampler(int spp, uint32_t s = 0) : sampler(spp, s) {}
+
+        virtual double get_1d() override {
+            uint32_t p = pixel_seed();
+            dimension++;
+            uint32_t i = nested_uniform_scramble(sample_index, p);
+            return to_unit_double(nested_uniform_scramble(sobol_dim0(i), hash_u32(p)));
+        }
+
+        virtual void get_2d(double &u1, double &u2) override {
+            uint32_t p = pixel_seed();
+            dimension += 2;
+            uint32_t i = nested_uniform_scramble(sample_index, p);
+            u1 = to_unit_double(nested_uniform_scramble(sobol_dim0(i), hash_combine(p, 1)));
+            u2 = to_unit_double(nested_uniform_scramble(sobol_dim1(i), hash_combine(p, 2)));
+        }
+
+        virtual sampler_type type() const override {return sampler_type::sobol; }
+        virtual std::unique_ptr<sampler> clone() const override {
+            return std::make_unique<sobol_sampler>(*this);
+        }
+};
+
+// Sobol sequence dithered per pixel by a toroidally shifted blue-noise mask,
+// which pushes the remaining error into high screen-space frequencies
+class blue_noise_sampler : public sampler {
+    public:
+        static const int MASK_SIZE = 64;
+
+        blue_noise_sampler(int spp, uint32_t s = 0) : sampler(spp, s) {
+            mask();
+        }
+
+        virtual double get_1d() override {
+            uint32_t d = dimension++;
+            uint32_t i = nested_uniform_scramble(sample_index, hash_combine(seed, d));
+            return wrap(to_unit_double(sobol_dim0(i)) + mask_value(d));
+        }
+
+        virtual void get_2d(double &u1, double &u2) override {
+            uint32_t d = dimension;
+            dimension += 2;
+            uint32_t i = nested_uniform_scramble(sample_index, hash_combine(seed, d));
+            u1 = wrap(to_unit_double(sobol_dim0(i)) + mask_value(d));
+            u2 = wrap(to_unit_double(sobol_dim1(i)) + mask_value(d + 1));
+        }
+
+        virtual sampler_type type() const override {return sampler_type::blue_noise; }
+        virtual std::unique_ptr<sampler> clone() const override {
+            return std::make_unique<blue_noise_sampler>(*this);
+        }
+
+    private:
+        static double wrap(double u){
+            return u >= 1.0 ? u - 1.0 : u;
+        }
+
+        // every dimension reads the mask at its own R2-sequence offset
+        double mask_value(uint32_t d) const {
+            int ox = int(MASK_SIZE * fmod(0.5 + d * 0.7548776662466927, 1.0));
+            int oy = int(MASK_SIZE * fmod(0.5 + d * 0.5698402909980532, 1.0));
+            int x = (px + ox) & (MASK_SIZE - 1);
+            int y = (py + oy) & (MASK_SIZE - 1);
+            return mask()[y * MASK_SIZE + x];
+        }
+
+        // void-and-cluster (Ulichney 1993) mask, generated once per process
+        static const std::vector<double>& mask(){
+            static const std::vector<double> values = build_mask();
+            return values;
+        }
+
+        static std::vector<double> build_mask(){
+            const int N = MASK_SIZE * MASK_SIZE;
+            const double sigma = 1.5;
+
+            std::vector<double> kernel(N);
+            for(int y=0; y<MASK_SIZE; y++){
+                for(int x=0; x<MASK_SIZE; x++){
+                    int dx = std::min(x, MASK_SIZE - x);
+                    int dy = std::min(y, MASK_SIZE - y);
+                    kernel[y * MASK_SIZE + x] = exp(-(dx*dx + dy*dy) / (2 * sigma * sigma));
+                }
+            }
+
+            std::vector<char> pattern(N, 0);
+            std::vector<double> energy(N, 0.0);
+            auto splat = [&](int idx, double sign){
+                int ix = idx % MASK_SIZE, iy = idx / MASK_SIZE;
+                for(int y=0; y<MASK_SIZE; y++){
+                    int ky = ((y - iy) & (MASK_SIZE - 1)) * MASK_SIZE;
+                    for(int x=0; x<MASK_SIZE; x++){
+                        energy[y * MASK_SIZE + x] += sign * kernel[ky + ((x - ix) & (MASK_SIZE - 1))];
+                    }
+                }
+            };
+            auto extreme = [&](char value, bool largest){
+                int best = -1;
+                for(int i=0; i<N; i++){
+                    if(pattern[i] == value && (best < 0 || (largest ? energy[i] > energy[best] : energy[i] < energy[best]))){
+                        best = i;
+                    }
+                }
+                return best;
+            };
+
+            // initial binary pattern, relaxed until the tightest cluster is the largest void
+            uint32_t state = 0x2545f491u;
+            int ones = N / 10;
+            for(int placed=0; placed<ones; ){
+                state = hash_u32(state);
+                int idx = int(state % N);
+                if(!pattern[idx]){
+                    pattern[idx] = 1;
+                    splat(idx, 1);
+                    placed++;
+                }
+            }
+            for(int iter=0; iter<N; iter++){
+                int cluster = extreme(1, true);
+                pattern[cluster] = 0;
+                splat(cluster, -1);
+                int void_ = extreme(0, false);
+                pattern[void_] = 1;
+                splat(void_, 1);
+                if(void_ == cluster){
+                    break;
+                }
+            }
+
+            std::vector<int> rank(N, 0);
+            std::vector<char> initial = pattern;
+            std::vector<double> initial_energy = energy;
+
+            // phase 1: remove clusters from the initial pattern
+            for(int r=ones-1; r>=0; r--){
+                int cluster = extreme(1, true);
+                pattern[cluster] = 0;
+                splat(cluster, -1);
+                rank[cluster] = r;
+            }
+
+            // phases 2 and 3: fill voids until every pixel is ranked
+            pattern = initial;
+            energy = initial_energy;
+            for(int r=ones; r<N; r++){
+                int void_ = extreme(0, false);
+                pattern[void_] = 1;
+                splat(void_, 1);
+                rank[void_] = r;
+            }
+
+            std::vector<double> values(N);
+            for(int i=0; i<N; i++){
+                values[i] = (rank[i] + 0.5) / N;
+            }
+            return values;
+        }
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef SKYBOX_H
+#define SKYBOX_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+#include <algorithm>
+#include "vec3.hpp"
+#include "ray.hpp"
+#include "mipmap.hpp"
+
+color GetPixelColor(const SDL_Surface* pSurface, const int X, const int Y){
+	const Uint8 Bpp = pSurface->format->BytesPerPixel;
+	Uint8* pPixel = (Uint8*)pSurface->pixels + Y * pSurface->pitch + X * Bpp;
+	Uint32 PixelData = *(Uint32*)pPixel;
+	SDL_Color Color = {0x00, 0x00, 0x00, SDL_ALPHA_OPAQUE};
+	SDL_GetRGB(PixelData, pSurface->format, &Color.r, &Color.g, &Color.b);
+	return color(1.0 * int(Color.r) / 255, 1.0 * int(Color.g) / 255, 1.0 * int(Color.b) / 255);
+}
+
+// equirectangular coordinates of a direction, as the skybox images are laid out
+inline void skybox_uv(const vec3 &dir, double &u, double &v){
+	double l = dir.length();
+	double theta = -asin(dir.y()/l) + M_PI_2;
+	double phi = dir.x() < 0 ? atan(dir.z()/dir.x()) + M_PI_2 : atan(dir.z()/dir.x()) + 3*M_PI/2;
+	u = phi / (2 * M_PI);
+	v = theta / M_PI;
+}
+
+// pixels of a loaded image as packed texels, rows top first
+inline std::vector<uint32_t> surface_texels(const SDL_Surface* s){
+	std::vector<uint32_t> rows(size_t(s->w) * s->h);
+	for(int y=0; y<s->h; y++){
+		for(int x=0; x<s->w; x++){
+			color c = GetPixelColor(s, x, y);
+			rows[size_t(y) * s->w + x] = pack_texel(int(c.x() * 255 + 0.5), int(c.y() * 255 + 0.5), int(c.z() * 255 + 0.5));
+		}
+	}
+	return rows;
+}
+
+// copies a loaded image into a tiled mip chain, empty when s is NULL
+inline mip_texture skybox_texture(const SDL_Surface* s){
+	if(s == NULL){
+		return mip_texture();
+	}
+	std::vector<uint32_t> rows = surface_texels(s);
+	return mip_texture(rows.data(), s->w, s->h);
+}
+
+// path roughness heuristic: a ray leaving a fully rough surface is treated as a
+// cone this wide (radians), so the skybox is read from a level whose texels are
+// about that size instead of from scattered full resolution texels
+const double DIFFUSE_SPREAD = 0.2;
+
+// spread is the angular width of the ray's footprint, 0 point samples level 0
+color skybox_color(const ray &r, const mip_texture &sky, double spread = 0.0){
+	if(sky.empty()){
+		return color(0, 0, 0);
+	}
+	double u, v;
+	skybox_uv(r.direction(), u, v);
+	return sky.sample(u, v, spread * sky.width() / (2 * M_PI));
+}
+
+// skybox as an environment light, importance sampled by luminance through a
+// piecewise-constant 2D distribution (marginal over rows, conditional per row)
+class environment_light {
+    public:
+        environment_light(const SDL_Surface* s) : environment_light(skybox_texture(s)) {}
+
+        // an image already in a mip chain, e.g. a constant sky for a furnace test
+        environment_light(mip_texture m) : map(std::move(m)) {
+            if(!map.empty()){
+                build();
+            }
+        }
+
+        bool empty() const {return map.empty(); }
+
+        color value(const ray &r, double spread = 0.0) const {
+            return skybox_color(r, map, spread);
+        }
+
+        // direction sampled proportionally to luminance*sin(theta), pdf in solid angle
+        vec3 sample(double u1, double u2, double &pdf_out) const {
+            int y = sample_row(u2);
+            const float* cdf = &conditional[size_t(y) * (w + 1)];
+            int x = int(std::upper_bound(cdf, cdf + w + 1, float(u1)) - cdf) - 1;
+            x = std::clamp(x, 0, w - 1);
+
+            double du = cdf[x+1] > cdf[x] ? (u1 - cdf[x]) / (cdf[x+1] - cdf[x]) : 0.5;
+            double dv = marginal[y+1] > marginal[y] ? (u2 - marginal[y]) / (marginal[y+1] - marginal[y]) : 0.5;
+            double phi = 2 * M_PI * (x + du) / w;
+            double theta = M_PI * (y + dv) / h;
+
+            vec3 dir = to_direction(theta, phi);
+            pdf_out = texel_pdf(x, y, theta);
+            return dir;
+        }
+
+        double pdf(const vec3 &v) const {
+            double su, sv;
+            skybox_uv(v, su, sv);
+            int x = std::clamp(int(w * su), 0, w - 1);
+            int y = std::clamp(int(h * sv), 0, h - 1);
+            return texel_pdf(x, y, M_PI * sv);
+        }
+
+    public:
+        // the distribution is built from level 0
+        mip_texture map;
+
+    private:
+        // inverse of the mapping used in skybox_color
+        static vec3 to_direction(double theta, double phi){
+            double sin_theta = sin(theta);
+            return vec3(-sin_theta * sin(phi), cos(theta), sin_theta * cos(phi));
+        }
+
+        double texel_pdf(int x, int y, double theta) const {
+            double sin_theta = sin(theta);
+            if(sin_theta <= 0 || total == 0){
+                return 0.0;
+            }
+            double pdf_uv = func[size_t(y) * w + x] * double(w) * h / total;
+            return pdf_uv / (2 * M_PI * M_PI * sin_theta);
+        }
+
+        int sample_row(double u) const {
+            int y = int(std::upper_bound(marginal.begin(), marginal.end(), float(u)) - marginal.begin()) - 1;
+            return std::clamp(y, 0, h - 1);
+        }
+
+        void build(){
+            w = map.width();
+            h = map.height();
+            func.assign(size_t(w) * h, 0.f);
+            conditional.assign(size_t(w + 1) * h, 0.f);
+            marginal.assign(h + 1, 0.f);
+
+            std::vector<double> row_sum(h, 0.0);
+            for(int y=0; y<h; y++){
+                double sin_theta = sin(M_PI * (y + 0.5) / h);
+                double sum = 0.0;
+                float* cdf = &conditional[size_t(y) * (w + 1)];
+                for(int x=0; x<w; x++){
+                    color c = unpack_texel(map.levels[0].at(x, y));
+                    double lum = 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+                    func[size_t(y) * w + x] = float(lum * sin_theta);
+                    sum += func[size_t(y) * w + x];
+                    cdf[x+1] = float(sum);
+                }
+                for(int x=1; x<=w; x++){
+                    cdf[x] = sum > 0 ? float(cdf[x] / sum) : float(x) / w;
+                }
+                row_sum[y] = sum;
+            }
+
+            total = 0.0;
+            for(int y=0; y<h; y++){
+                total += row_sum[y];
+                marginal[y+1] = float(total);
+            }
+            for(int y=1; y<=h; y++){
+                marginal[y] = total > 0 ? float(marginal[y] / total) : float(y) / h;
+            }
+        }
+
+    private:
+        int w = 0;
+        int h = 0;
+        double total = 0.0;
+        std::vector<float> func;
+        std::vector<float> conditional;
+        std::vector<float> marginal;
+};
+
+#endif
@@ -4,16 +4,33 @@
 #include "hittable.hpp"
 #include "material.hpp"
 #include "vec3.hpp"
+#include "onb.hpp"
+#include <algorithm>
 #include <memory>
 
 using std::cout, std::endl;
 
+// texture coordinates of a point on the unit sphere: u goes around the y axis
+// starting from -x, v from the bottom (-y) to the top
+inline void sphere_uv(const vec3& p, double& u, double& v){
+    auto theta = acos(std::clamp(-p.y(), -1.0, 1.0));
+    auto phi = atan2(-p.z(), p.x()) + M_PI;
+    u = phi / (2*M_PI);
+    v = theta / M_PI;
+}
+
 class sphere : public hittable {
     public:
         sphere() {}
         sphere(point3 cen, double r, std::shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void translate(const vec3& offset) override {center += offset;}
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 sample_direction(const point3& o, const vec3& u) const override;
     
 
     public:
@@ -22,7 +39,7 @@ class sphere : public hittable {
         std::shared_ptr<material> mat_ptr;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
+bool sphere::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto b_h = dot(oc, r.direction());
@@ -37,19 +54,77 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     auto t_max_a = t_max * a;
     auto pseudo_root = -b_h - sqrtd;
     if(pseudo_root < t_min_a || t_max_a < pseudo_root){
-        auto pseudo_root = -b_h + sqrtd;
+        pseudo_root = -b_h + sqrtd;
         if(pseudo_root < t_min_a || t_max_a < pseudo_root){
             return false;
         }
     }
 
     rec.t = pseudo_root / a;
+    rec.obj = this;
+
+    return true;
+}
+
+void sphere::finalize(const ray& r, hit_record& rec) const{
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
+    sphere_uv(outward_normal, rec.u, rec.v);
     rec.mat_ptr = mat_ptr;
+}
 
+bool sphere::occluded(const ray& r, double t_min, double t_max) const{
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto b_h = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+    auto discriminant = b_h*b_h - a*c;
+    if(discriminant < 0){
+        return false;
+    }
+
+    auto sqrtd = sqrt(discriminant);
+    auto t_min_a = t_min * a;
+    auto t_max_a = t_max * a;
+    auto near_root = -b_h - sqrtd;
+    if(t_min_a < near_root && near_root < t_max_a){
+        return true;
+    }
+    auto far_root = -b_h + sqrtd;
+    return t_min_a < far_root && far_root < t_max_a;
+}
+
+bool sphere::bounding_box(aabb& output_box) const{
+    vec3 r(radius, radius, radius);
+    output_box = aabb(center - r, center + r);
     return true;
 }
 
+// uniform sampling of the cone subtended by the sphere
+double sphere::pdf_value(const point3& o, const vec3& v) const{
+    auto distance_squared = (center - o).length_squared();
+    if(distance_squared <= radius*radius || !occluded(ray(o, v), 0.001, INFINITY)){
+        return 0.0;
+    }
+
+    auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+    auto solid_angle = 2*M_PI*(1 - cos_theta_max);
+    return 1 / solid_angle;
+}
+
+vec3 sphere::sample_direction(const point3& o, const vec3& u) const{
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    onb uvw(direction);
+
+    auto r1 = u[0];
+    auto r2 = u[1];
+    auto cos_theta_max = sqrt(std::max(0.0, 1 - radius*radius/distance_squared));
+    auto z = 1 + r2*(cos_theta_max - 1);
+    auto phi = 2*M_PI*r1;
+    auto sin_theta = sqrt(std::max(0.0, 1 - z*z));
+    return uvw.local(cos(phi)*sin_theta, sin(phi)*sin_theta, z);
+}
+
 #endif
\ No newline at end of file
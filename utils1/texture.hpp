@@ -0,0 +1,59 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include "vec3.hpp"
+#include "mipmap.hpp"
+#include "texture_cache.hpp"
+
+class texture {
+    public:
+        // colour at surface coordinates (u, v) of a hit, (0, 0) is the bottom left of an image
+        virtual color value(double u, double v) const = 0;
+};
+
+// an image preprocessed into a page file, see texture_cache.hpp; only the pages
+// that lookups touch are read, and they share the process-wide page budget.
+// Coordinates outside [0, 1] repeat the image, lookups are bilinear
+class image_texture : public texture {
+    public:
+        image_texture(const std::string &path) : id(texture_cache::global().open(path)) {
+            if(id < 0){
+                std::cerr << "Failed to open texture " << path << "." << std::endl;
+                return;
+            }
+            width = texture_cache::global().width(id);
+            height = texture_cache::global().height(id);
+        }
+
+        virtual color value(double u, double v) const override;
+
+    public:
+        int id;
+        int width = 0;
+        int height = 0;
+};
+
+color image_texture::value(double u, double v) const{
+    // cyan marks a texture that failed to load
+    if(id < 0){
+        return color(0, 1, 1);
+    }
+    double fx = (u - std::floor(u)) * width - 0.5;
+    double fy = (std::ceil(v) - v) * height - 0.5;
+    int x0 = int(std::floor(fx));
+    int y0 = int(std::floor(fy));
+    double ax = fx - x0;
+    double ay = fy - y0;
+    int xa = x0 < 0 ? width - 1 : x0, xb = x0 + 1 >= width ? 0 : x0 + 1;
+    int ya = y0 < 0 ? height - 1 : y0, yb = y0 + 1 >= height ? 0 : y0 + 1;
+
+    texture_cache &cache = texture_cache::global();
+    color top = (1 - ax) * texel_bytes(cache.texel(id, xa, ya)) + ax * texel_bytes(cache.texel(id, xb, ya));
+    color bottom = (1 - ax) * texel_bytes(cache.texel(id, xa, yb)) + ax * texel_bytes(cache.texel(id, xb, yb));
+    return ((1 - ay) * top + ay * bottom) / 255.0;
+}
+
+#endif
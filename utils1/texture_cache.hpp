@@ -0,0 +1,245 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Image textures too large to keep in memory all at once. A texture is
+// preprocessed into a page file (.rtx): a texture_file_header followed by
+// square pages of TEXTURE_PAGE x TEXTURE_PAGE packed texels (r | g << 8 |
+// b << 16, rows top first inside a page, pages in row-major order, edge pages
+// padded with the last texel). Every page sits at a fixed offset, so it can be
+// read on its own. One process-wide cache holds the pages that were used
+// recently, up to a byte budget, and drops the least recently used ones
+// beyond that. Like the farm messages, the file is native-endian.
+
+const int32_t TEXTURE_MAGIC = 0x58545452;
+const int TEXTURE_PAGE = 32;
+
+struct texture_file_header {
+    int32_t magic;
+    int32_t width;
+    int32_t height;
+    int32_t page;
+};
+
+struct texture_page {
+    uint32_t texels[TEXTURE_PAGE * TEXTURE_PAGE];
+};
+
+inline int64_t texture_page_offset(int page_index){
+    return int64_t(sizeof(texture_file_header)) + int64_t(page_index) * int64_t(sizeof(texture_page));
+}
+
+inline int texture_seek(FILE *f, int64_t offset){
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, off_t(offset), SEEK_SET);
+#endif
+}
+
+// writes rows of w x h packed texels, top row first, as a page file
+inline bool write_texture_pages(const std::string &path, const uint32_t *rows, int w, int h){
+    FILE *f = fopen(path.c_str(), "wb");
+    if(f == NULL){
+        return false;
+    }
+    texture_file_header header = {TEXTURE_MAGIC, w, h, TEXTURE_PAGE};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    texture_page page;
+    for(int py=0; ok && py<h; py+=TEXTURE_PAGE){
+        for(int px=0; ok && px<w; px+=TEXTURE_PAGE){
+            for(int y=0; y<TEXTURE_PAGE; y++){
+                for(int x=0; x<TEXTURE_PAGE; x++){
+                    int sx = std::min(px + x, w - 1);
+                    int sy = std::min(py + y, h - 1);
+                    page.texels[y * TEXTURE_PAGE + x] = rows[size_t(sy) * w + sx];
+                }
+            }
+            ok = fwrite(&page, sizeof(page), 1, f) == 1;
+        }
+    }
+    return fclose(f) == 0 && ok;
+}
+
+class texture_cache {
+    public:
+        // the cache every texture in the process shares
+        static texture_cache& global(){
+            static texture_cache cache;
+            return cache;
+        }
+
+        // bytes of pages kept in memory; a page in use by a lookup may outlive its eviction
+        void set_capacity(size_t bytes);
+
+        // id of the page file, -1 if it cannot be read; the same path gives the same id.
+        // Files are opened while the scene is built, before any thread looks pages up
+        int open(const std::string &path);
+
+        int width(int id) const {return files[id]->header.width; }
+        int height(int id) const {return files[id]->header.height; }
+
+        // texel (x, y) of a file, its page read from disk when it is not resident
+        uint32_t texel(int id, int x, int y){
+            const page_file &file = *files[id];
+            const texture_page &p = page(id, (y / TEXTURE_PAGE) * file.pages_x + x / TEXTURE_PAGE);
+            return p.texels[(y % TEXTURE_PAGE) * TEXTURE_PAGE + x % TEXTURE_PAGE];
+        }
+
+        size_t resident() const;
+
+    public:
+        // lookups of a resident page other than the thread's last one, and page reads
+        std::atomic<long long> hits{0};
+        std::atomic<long long> misses{0};
+        std::atomic<long long> evictions{0};
+
+    private:
+        texture_cache() {}
+        texture_cache(const texture_cache&) = delete;
+        ~texture_cache();
+
+        struct page_file {
+            std::string path;
+            FILE *f;
+            texture_file_header header;
+            int pages_x;
+            // seek and read are one operation per file
+            std::mutex m;
+        };
+
+        typedef std::list<std::pair<uint64_t, std::shared_ptr<const texture_page>>> lru_list;
+
+        const texture_page& page(int id, int page_index);
+        std::shared_ptr<const texture_page> load(int id, int page_index);
+        void trim();
+
+    private:
+        std::vector<std::unique_ptr<page_file>> files;
+        lru_list lru;
+        std::unordered_map<uint64_t, lru_list::iterator> index;
+        size_t capacity = size_t(256) << 20;
+        mutable std::mutex m;
+};
+
+texture_cache::~texture_cache(){
+    for(auto &file : files){
+        fclose(file->f);
+    }
+}
+
+void texture_cache::set_capacity(size_t bytes){
+    std::lock_guard<std::mutex> lock(m);
+    capacity = bytes;
+    trim();
+}
+
+int texture_cache::open(const std::string &path){
+    std::lock_guard<std::mutex> lock(m);
+    for(size_t i=0; i<files.size(); i++){
+        if(files[i]->path == path){
+            return int(i);
+        }
+    }
+
+    FILE *f = fopen(path.c_str(), "rb");
+    if(f == NULL){
+        return -1;
+    }
+    texture_file_header header;
+    if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != TEXTURE_MAGIC || header.page != TEXTURE_PAGE
+       || header.width <= 0 || header.height <= 0){
+        fclose(f);
+        return -1;
+    }
+
+    std::unique_ptr<page_file> file(new page_file());
+    file->path = path;
+    file->f = f;
+    file->header = header;
+    file->pages_x = (header.width + TEXTURE_PAGE - 1) / TEXTURE_PAGE;
+    files.push_back(std::move(file));
+    return int(files.size() - 1);
+}
+
+// the returned page stays valid until this thread asks for another one
+const texture_page& texture_cache::page(int id, int page_index){
+    uint64_t key = uint64_t(id) << 32 | uint32_t(page_index);
+
+    // neighbouring lookups of one thread mostly land on the page it used last,
+    // which it holds on to, so those need neither the lock nor a reference count
+    thread_local uint64_t last_key = ~uint64_t(0);
+    thread_local std::shared_ptr<const texture_page> last;
+    if(key == last_key){
+        return *last;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m);
+        auto found = index.find(key);
+        if(found != index.end()){
+            lru.splice(lru.begin(), lru, found->second);
+            hits++;
+            last_key = key;
+            last = found->second->second;
+            return *last;
+        }
+    }
+
+    // read without holding the cache, another thread may load the same page meanwhile
+    std::shared_ptr<const texture_page> loaded = load(id, page_index);
+    misses++;
+
+    std::lock_guard<std::mutex> lock(m);
+    auto found = index.find(key);
+    if(found != index.end()){
+        loaded = found->second->second;
+        lru.splice(lru.begin(), lru, found->second);
+    }
+    else{
+        lru.emplace_front(key, loaded);
+        index[key] = lru.begin();
+        trim();
+    }
+    last_key = key;
+    last = loaded;
+    return *last;
+}
+
+// a page that cannot be read comes back black rather than failing the render
+std::shared_ptr<const texture_page> texture_cache::load(int id, int page_index){
+    page_file &file = *files[id];
+    std::shared_ptr<texture_page> p = std::make_shared<texture_page>();
+    std::lock_guard<std::mutex> lock(file.m);
+    if(texture_seek(file.f, texture_page_offset(page_index)) != 0 || fread(p.get(), sizeof(texture_page), 1, file.f) != 1){
+        std::fill(p->texels, p->texels + TEXTURE_PAGE * TEXTURE_PAGE, 0u);
+    }
+    return p;
+}
+
+// called with m held; the newest page always stays
+void texture_cache::trim(){
+    while(lru.size() > 1 && lru.size() * sizeof(texture_page) > capacity){
+        index.erase(lru.back().first);
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+size_t texture_cache::resident() const{
+    std::lock_guard<std::mutex> lock(m);
+    return lru.size() * sizeof(texture_page);
+}
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef TILE_FARM_H
+#define TILE_FARM_H
+
+#include "net.hpp"
+#include "tonemap.hpp"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Tile rendering across processes. A coordinator listens for workers, hands
+// each one tile at a time and merges the float tiles they send back. Workers
+// run the same binary with the same built-in scene. A worker whose connection
+// drops has its tile put back in the queue; a tile that takes longer than the
+// timeout is also given to an idle worker, and whichever copy arrives first
+// is kept. A new connection is only a worker once its hello has arrived, and
+// it is read as it comes in, so a connection that stays silent never holds up
+// the others. Messages are raw native-endian int32/float, so every machine in
+// the farm must share the byte order.
+
+const int32_t FARM_MAGIC = 0x31465452;
+const int32_t FARM_QUIT = -1;
+
+// x0, y0, x1, y1 cover [x0, x1) x [y0, y1)
+struct farm_tile {
+    int32_t id;
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+
+    int pixels() const {return (x1 - x0) * (y1 - y0); }
+};
+
+struct farm_hello {
+    int32_t magic;
+    int32_t width;
+    int32_t height;
+};
+
+class tile_coordinator {
+    public:
+        tile_coordinator(int w, int h, int tile_size, double timeout_seconds = 60.0)
+            : film(w, h), tile_timeout(timeout_seconds) {
+            for(int y=0; y<h; y+=tile_size){
+                for(int x=0; x<w; x+=tile_size){
+                    tiles.push_back({int32_t(tiles.size()), x, y, std::min(x + tile_size, w), std::min(y + tile_size, h)});
+                }
+            }
+        }
+
+        // serves tiles until every one has come back, false if the port cannot be opened.
+        // Only this machine can connect unless address is another interface or 0.0.0.0
+        bool run(int port, std::function<void(int done, int total)> progress = nullptr, const std::string &address = "127.0.0.1");
+
+    public:
+        accum_buffer film;
+        double tile_timeout;
+        // a connection that has not sent its whole hello by then is closed
+        double hello_timeout = 5.0;
+        // a worker that stops halfway through sending a tile is dropped after this
+        int receive_timeout_ms = 10000;
+        std::vector<farm_tile> tiles;
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct worker {
+            socket_t sock;
+            int tile;
+            // when the tile was sent, or when the connection was accepted
+            clock::time_point started;
+            bool greeted;
+            size_t hello_bytes;
+            farm_hello hello;
+        };
+
+        bool assign(worker &w);
+        bool receive(worker &w);
+        bool greet(worker &w);
+        void drop(size_t index);
+
+    private:
+        std::vector<worker> workers;
+        std::deque<int> queue;
+        std::vector<bool> done;
+        int done_count = 0;
+};
+
+bool tile_coordinator::assign(worker &w){
+    w.tile = -1;
+    if(!queue.empty()){
+        w.tile = queue.front();
+        queue.pop_front();
+    }
+    else{
+        // nothing queued: duplicate the oldest overdue tile, if any
+        double oldest = tile_timeout;
+        for(const worker &other : workers){
+            double age = std::chrono::duration<double>(clock::now() - other.started).count();
+            if(other.tile >= 0 && !done[other.tile] && age > oldest){
+                oldest = age;
+                w.tile = other.tile;
+            }
+        }
+    }
+    if(w.tile < 0){
+        return true;
+    }
+    w.started = clock::now();
+    return send_all(w.sock, &tiles[w.tile], sizeof(farm_tile));
+}
+
+bool tile_coordinator::receive(worker &w){
+    farm_tile t;
+    if(!recv_all(w.sock, &t, sizeof(t)) || t.id < 0 || t.id >= int(tiles.size())){
+        return false;
+    }
+    const farm_tile &tile = tiles[t.id];
+    if(t.x0 != tile.x0 || t.y0 != tile.y0 || t.x1 != tile.x1 || t.y1 != tile.y1){
+        return false;
+    }
+    std::vector<float> rgb(size_t(t.pixels()) * 3);
+    if(!recv_all(w.sock, rgb.data(), rgb.size() * sizeof(float))){
+        return false;
+    }
+
+    if(!done[t.id]){
+        size_t k = 0;
+        for(int y=tile.y0; y<tile.y1; y++){
+            for(int x=tile.x0; x<tile.x1; x++, k++){
+                size_t p = size_t(y) * film.width + x;
+                film.r[p] = rgb[3*k];
+                film.g[p] = rgb[3*k + 1];
+                film.b[p] = rgb[3*k + 2];
+            }
+        }
+        done[t.id] = true;
+        done_count++;
+    }
+    return true;
+}
+
+// reads what has arrived of the hello, false when it is wrong or the peer hung up
+bool tile_coordinator::greet(worker &w){
+    int n = recv_some(w.sock, (char*)&w.hello + w.hello_bytes, sizeof(farm_hello) - w.hello_bytes);
+    if(n <= 0){
+        return false;
+    }
+    w.hello_bytes += size_t(n);
+    if(w.hello_bytes < sizeof(farm_hello)){
+        return true;
+    }
+    if(w.hello.magic != FARM_MAGIC || w.hello.width != film.width || w.hello.height != film.height){
+        return false;
+    }
+    w.greeted = true;
+    set_recv_timeout(w.sock, receive_timeout_ms);
+    return true;
+}
+
+void tile_coordinator::drop(size_t index){
+    worker &w = workers[index];
+    if(w.tile >= 0 && !done[w.tile]){
+        queue.push_front(w.tile);
+    }
+    close_socket(w.sock);
+    workers.erase(workers.begin() + index);
+}
+
+bool tile_coordinator::run(int port, std::function<void(int done, int total)> progress, const std::string &address){
+    socket_t listener = tcp_listen(port, address);
+    if(listener == INVALID_SOCK){
+        return false;
+    }
+
+    queue.clear();
+    for(const farm_tile &t : tiles){
+        queue.push_back(t.id);
+    }
+    done.assign(tiles.size(), false);
+    done_count = 0;
+
+    std::vector<socket_t> sockets;
+    std::vector<bool> ready;
+    while(done_count < int(tiles.size())){
+        sockets.clear();
+        sockets.push_back(listener);
+        for(const worker &w : workers){
+            sockets.push_back(w.sock);
+        }
+        wait_readable(sockets, 250, ready);
+
+        // back to front so drop() keeps the remaining indices valid
+        for(size_t i=workers.size(); i-- > 0;){
+            bool readable = i + 1 < ready.size() && ready[i + 1];
+            if(!workers[i].greeted){
+                double age = std::chrono::duration<double>(clock::now() - workers[i].started).count();
+                if(readable ? !greet(workers[i]) : age > hello_timeout){
+                    drop(i);
+                    continue;
+                }
+                if(!workers[i].greeted){
+                    continue;
+                }
+            }
+            else if(readable && !receive(workers[i])){
+                std::cerr << "worker lost, tile " << workers[i].tile << " requeued" << std::endl;
+                drop(i);
+                continue;
+            }
+            // a worker whose tile was finished by a duplicate still delivers it first
+            if(readable || workers[i].tile < 0){
+                if(done_count < int(tiles.size()) && !assign(workers[i])){
+                    drop(i);
+                }
+            }
+        }
+
+        // accepted after the loop above, so its ready flags still line up with workers
+        if(ready[0]){
+            socket_t s = tcp_accept(listener);
+            if(s != INVALID_SOCK){
+                workers.push_back({s, -1, clock::now(), false, 0, farm_hello()});
+            }
+        }
+
+        if(progress){
+            progress(done_count, int(tiles.size()));
+        }
+    }
+
+    for(const worker &w : workers){
+        farm_tile quit = {FARM_QUIT, 0, 0, 0, 0};
+        send_all(w.sock, &quit, sizeof(quit));
+        close_socket(w.sock);
+    }
+    workers.clear();
+    close_socket(listener);
+    return true;
+}
+
+// connects to a coordinator and renders tiles until told to stop;
+// render(tile, rgb) fills 3 floats per pixel, row by row. Workers may start
+// before the coordinator listens, so connecting is retried for a while
+inline bool run_tile_worker(const std::string &host, int port, int width, int height,
+                            std::function<void(const farm_tile&, float*)> render, double connect_seconds = 10.0){
+    socket_t s = tcp_connect(host, port);
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::duration<double>(connect_seconds);
+    while(s == INVALID_SOCK && std::chrono::steady_clock::now() < give_up){
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        s = tcp_connect(host, port);
+    }
+    if(s == INVALID_SOCK){
+        return false;
+    }
+    farm_hello hello = {FARM_MAGIC, width, height};
+    bool ok = send_all(s, &hello, sizeof(hello));
+
+    std::vector<float> rgb;
+    farm_tile t;
+    while(ok && recv_all(s, &t, sizeof(t)) && t.id != FARM_QUIT){
+        rgb.assign(size_t(t.pixels()) * 3, 0.0f);
+        render(t, rgb.data());
+        ok = send_all(s, &t, sizeof(t)) && send_all(s, rgb.data(), rgb.size() * sizeof(float));
+    }
+    close_socket(s);
+    return ok;
+}
+
+#endif
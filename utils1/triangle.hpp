@@ -4,53 +4,266 @@
 #include "hittable.hpp"
 #include "material.hpp"
 #include "vec3.hpp"
+#include <algorithm>
 #include <memory>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using std::cout, std::endl;
 
+// Moller-Trumbore against the corner p0 and edges e1 = p1 - p0, e2 = p2 - p0,
+// for storage that keeps only the edges. A ray parallel to the plane has det 0
+// and is rejected before the division; t is tested before the barycentrics.
+// u and v are the weights of p1 and p2
+inline bool intersect_triangle(const ray& r, const point3& p0, const vec3& e1, const vec3& e2,
+                               double t_min, double t_max, double& t, double& u, double& v){
+    vec3 pvec = cross(r.direction(), e2);
+    double det = dot(e1, pvec);
+    if(det == 0){
+        return false;
+    }
+    double inv_det = 1 / det;
+    vec3 tvec = r.origin() - p0;
+    vec3 qvec = cross(tvec, e1);
+    t = dot(e2, qvec) * inv_det;
+    if(!(t > t_min && t < t_max)){
+        return false;
+    }
+    u = dot(tvec, pvec) * inv_det;
+    if(u < 0 || u > 1){
+        return false;
+    }
+    v = dot(r.direction(), qvec) * inv_det;
+    return v >= 0 && u + v <= 1;
+}
+
+// Plane first, then barycentrics by projecting onto precomputed axes (after
+// Baldwin and Weber): n is the unit normal, u_axis and v_axis are the duals of
+// the edges in the plane, so no cross product is needed per ray. Rays
+// parallel to the plane are rejected before the division, and most misses
+// leave after one dot product and the t test
+inline bool intersect_triangle_plane(const ray& r, const point3& p0, const vec3& n, const vec3& u_axis, const vec3& v_axis,
+                                     double t_min, double t_max, double& t, double& u, double& v){
+    double denom = dot(n, r.direction());
+    if(denom == 0){
+        return false;
+    }
+    vec3 tvec = r.origin() - p0;
+    t = -dot(n, tvec) / denom;
+    if(!(t > t_min && t < t_max)){
+        return false;
+    }
+    vec3 q = tvec + t * r.direction();
+    u = dot(q, u_axis);
+    if(u < 0 || u > 1){
+        return false;
+    }
+    v = dot(q, v_axis);
+    return v >= 0 && u + v <= 1;
+}
+
 class triangle : public hittable {
     public:
         triangle() {}
-        triangle(point3 p0_, point3 p1_, point3 p2_, std::shared_ptr<material> m) : p0(p0_), p1(p1_), p2(p2_), mat_ptr(m) {normal = unit_vector(cross(p1-p0, p2-p0));};
+        triangle(point3 p0_, point3 p1_, point3 p2_, std::shared_ptr<material> m) : p0(p0_), e1(p1_ - p0_), e2(p2_ - p0_), mat_ptr(m) {
+            vec3 n = cross(e1, e2);
+            normal = unit_vector(n);
+            u_axis = cross(e2, n) / n.length_squared();
+            v_axis = cross(n, e1) / n.length_squared();
+        };
+        // with texture coordinates for each corner, (u, v) in x and y
+        triangle(point3 p0_, point3 p1_, point3 p2_, vec3 uv0, vec3 uv1, vec3 uv2, std::shared_ptr<material> m) : triangle(p0_, p1_, p2_, m) {
+            const vec3 corners[3] = {uv0, uv1, uv2};
+            for(int k=0; k<3; k++){
+                uv[k][0] = float(corners[k].x());
+                uv[k][1] = float(corners[k].y());
+            }
+            mapped = true;
+        };
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void translate(const vec3& offset) override {p0 += offset;}
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 sample_direction(const point3& o, const vec3& u) const override;
     
 
     public:
+        // the corners are p0, p0 + e1 and p0 + e2; moves only change p0
         point3 p0;
-        point3 p1;
-        point3 p2;
+        vec3 e1;
+        vec3 e2;
         vec3 normal;
+        // dot products with these give the weights of the second and third corner
+        vec3 u_axis;
+        vec3 v_axis;
+        // texture coordinates of the corners; without them (u, v) of a hit are those weights
+        float uv[3][2];
+        bool mapped = false;
         std::shared_ptr<material> mat_ptr;
 };
 
-bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
-    auto t = dot(p0 - r.origin(), normal) / dot(normal, r.direction());
-    point3 intersection = r.at(t);
-
-    double e0 = dot(normal, cross(intersection - p0, p1 - p0));
-    if(e0 > 0){
+bool triangle::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    double t, u, v;
+    if(!intersect_triangle_plane(r, p0, normal, u_axis, v_axis, t_min, t_max, t, u, v)){
         return false;
     }
-    double e1 = dot(normal, cross(intersection - p1, p2 - p1));
-    if(e1 > 0){
-        return false;
+    rec.t = t;
+    rec.u = u;
+    rec.v = v;
+    rec.obj = this;
+    return true;
+}
+
+void triangle::finalize(const ray& r, hit_record& rec) const{
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = dot(r.direction(), normal) > 0 ? normal : -normal;
+    rec.set_face_normal(r, outward_normal);
+    if(mapped){
+        double w = 1 - rec.u - rec.v;
+        double u = w * uv[0][0] + rec.u * uv[1][0] + rec.v * uv[2][0];
+        rec.v = w * uv[0][1] + rec.u * uv[1][1] + rec.v * uv[2][1];
+        rec.u = u;
     }
-    double e2 = dot(normal, cross(intersection - p2, p0 - p2));
-    if(e2 > 0){
-        return false;
+    rec.mat_ptr = mat_ptr;
+}
+
+bool triangle::occluded(const ray& r, double t_min, double t_max) const{
+    double t, u, v;
+    return intersect_triangle_plane(r, p0, normal, u_axis, v_axis, t_min, t_max, t, u, v);
+}
+
+bool triangle::bounding_box(aabb& output_box) const{
+    output_box = aabb();
+    output_box.expand(p0);
+    output_box.expand(p0 + e1);
+    output_box.expand(p0 + e2);
+    return true;
+}
+
+// uniform sampling by area, converted to solid angle as seen from o
+double triangle::pdf_value(const point3& o, const vec3& v) const{
+    double t, a, b;
+    if(!intersect_triangle_plane(ray(o, v), p0, normal, u_axis, v_axis, 0.001, INFINITY, t, a, b)){
+        return 0.0;
+    }
+
+    auto area = 0.5 * cross(e1, e2).length();
+    auto distance_squared = t*t * v.length_squared();
+    auto cosine = fabs(dot(v, normal)) / v.length();
+    return distance_squared / (cosine * area);
+}
+
+vec3 triangle::sample_direction(const point3& o, const vec3& u) const{
+    auto su = sqrt(u[0]);
+    auto b1 = 1 - su;
+    auto b2 = u[1] * su;
+    return p0 + b1*e1 + b2*e2 - o;
+}
+
+// Four triangles in float SoA form, tested against one ray at once with SSE;
+// unused lanes are degenerate (zero edges) and never hit
+struct triangle4 {
+    float p0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    int count = 0;
+
+    triangle4(){
+        for(int a=0; a<3; a++){
+            for(int k=0; k<4; k++){
+                p0[a][k] = e1[a][k] = e2[a][k] = 0.0f;
+            }
+        }
     }
 
-    if(t > t_min &&  t_max > t){
-        rec.t = t;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = dot(r.direction(), normal) > 0 ? normal : -normal;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat_ptr;
+    // false when all four lanes are taken
+    bool add(const point3& q0, const vec3& d1, const vec3& d2){
+        if(count == 4){
+            return false;
+        }
+        for(int a=0; a<3; a++){
+            p0[a][count] = float(q0[a]);
+            e1[a][count] = float(d1[a]);
+            e2[a][count] = float(d2[a]);
+        }
+        count++;
         return true;
     }
+};
+
+// closest lane hit in (t_min, t_max) with its t, u, v, or -1
+inline int intersect_triangle4(const triangle4& tri, const ray& r, double t_min, double t_max, double& t, double& u, double& v){
+#ifdef __SSE2__
+    const __m128 dx = _mm_set1_ps(float(r.direction().x())), dy = _mm_set1_ps(float(r.direction().y())), dz = _mm_set1_ps(float(r.direction().z()));
+    const __m128 e1x = _mm_loadu_ps(tri.e1[0]), e1y = _mm_loadu_ps(tri.e1[1]), e1z = _mm_loadu_ps(tri.e1[2]);
+    const __m128 e2x = _mm_loadu_ps(tri.e2[0]), e2y = _mm_loadu_ps(tri.e2[1]), e2z = _mm_loadu_ps(tri.e2[2]);
+
+    // pvec = d x e2, det = e1 . pvec
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 valid = _mm_cmpneq_ps(det, _mm_setzero_ps());
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(float(r.origin().x())), _mm_loadu_ps(tri.p0[0]));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(float(r.origin().y())), _mm_loadu_ps(tri.p0[1]));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(float(r.origin().z())), _mm_loadu_ps(tri.p0[2]));
+
+    // qvec = tvec x e1
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
 
-    return false;
+    __m128 t4 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+    __m128 u4 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    __m128 v4 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t4, _mm_set1_ps(float(t_min))));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t4, _mm_set1_ps(float(std::min(t_max, 3.0e38)))));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u4, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v4, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u4, v4), one));
+    int mask = _mm_movemask_ps(valid);
+    if(mask == 0){
+        return -1;
+    }
+
+    alignas(16) float ts[4], us[4], vs[4];
+    _mm_store_ps(ts, t4);
+    _mm_store_ps(us, u4);
+    _mm_store_ps(vs, v4);
+    int best = -1;
+    for(int k=0; k<4; k++){
+        if((mask >> k & 1) && (best < 0 || ts[k] < ts[best])){
+            best = k;
+        }
+    }
+    t = ts[best];
+    u = us[best];
+    v = vs[best];
+    return best;
+#else
+    int best = -1;
+    for(int k=0; k<tri.count; k++){
+        double tk, uk, vk;
+        point3 q0(tri.p0[0][k], tri.p0[1][k], tri.p0[2][k]);
+        vec3 d1(tri.e1[0][k], tri.e1[1][k], tri.e1[2][k]);
+        vec3 d2(tri.e2[0][k], tri.e2[1][k], tri.e2[2][k]);
+        if(intersect_triangle(r, q0, d1, d2, t_min, best < 0 ? t_max : t, tk, uk, vk)){
+            best = k;
+            t = tk;
+            u = uk;
+            v = vk;
+        }
+    }
+    return best;
+#endif
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,658 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "hittable.hpp"
+#include "aabb.hpp"
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+using std::shared_ptr;
+
+struct bvh_node {
+    aabb box;
+    int parent;
+    int left;
+    int right;
+    int prim;
+
+    bool leaf() const {return prim >= 0; }
+};
+
+// Binary BVH with one object per leaf. It is built top-down with binned SAH,
+// and can also be changed in place: objects are inserted and removed in
+// O(depth), and moved objects are refit along their path to the root.
+// Unbounded objects (planes) are kept in a list next to the tree.
+class bvh : public hittable {
+    public:
+        bvh() {}
+        bvh(const std::vector<shared_ptr<hittable>>& list) {
+            for(const auto &object : list){
+                add_object(object);
+            }
+            rebuild();
+        }
+
+        // object registry, ids stay valid until remove()
+        int insert(shared_ptr<hittable> object){
+            int id = add_object(object);
+            insert_leaf(id);
+            return id;
+        }
+
+        // removing an id twice must not free it twice
+        void remove(int id){
+            if(objects[id] == nullptr){
+                return;
+            }
+            remove_leaf(id);
+            objects[id] = nullptr;
+            free_ids.push_back(id);
+        }
+
+        // refit the path from a moved object's leaf to the root
+        void update(int id);
+
+        void rebuild();
+        void rebuild_subtree(int node);
+
+        // SAH cost of the current tree relative to its root area, the quality metric.
+        // The node areas are summed as boxes change, so this is O(1)
+        double sah_cost() const {
+            return root >= 0 && nodes[root].box.surface_area() > 0 ? area_cost / nodes[root].box.surface_area() : 0.0;
+        }
+
+        // the same cost summed over every node, O(N)
+        double sah_cost_walk() const;
+
+        // subtree whose children overlap most, limited to max_leaves objects
+        int worst_subtree(int max_leaves) const;
+
+        // builds nodes for (id, box) pairs from boxes alone, so it can run on another
+        // thread while the objects keep moving; returns the root index into out
+        static int build_nodes(std::vector<std::pair<int, aabb>> items, std::vector<bvh_node>& out);
+
+        // replace the whole tree with nodes produced by build_nodes
+        void install(std::vector<bvh_node>&& new_nodes, int new_root);
+
+        void insert_leaf(int id);
+        void remove_leaf(int id);
+        bool in_tree(int id) const {return id < int(leaf_of.size()) && leaf_of[id] >= 0; }
+
+        int size() const {return int(objects.size() - free_ids.size()); }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+
+    public:
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<bvh_node> nodes;
+        std::vector<int> unbounded;
+        int root = -1;
+
+    private:
+        int add_object(shared_ptr<hittable> object){
+            int id;
+            if(!free_ids.empty()){
+                id = free_ids.back();
+                free_ids.pop_back();
+                objects[id] = object;
+            }
+            else{
+                id = int(objects.size());
+                objects.push_back(object);
+                leaf_of.push_back(-1);
+            }
+            leaf_of[id] = -1;
+            return id;
+        }
+
+        static constexpr double C_TRAVERSE = 1.0;
+        static constexpr double C_INTERSECT = 1.0;
+
+        double node_cost(int n) const {
+            return (nodes[n].leaf() ? C_INTERSECT : C_TRAVERSE) * nodes[n].box.surface_area();
+        }
+
+        // every change to the box of a node in the tree goes through here
+        void set_box(int n, const aabb &box){
+            area_cost -= node_cost(n);
+            nodes[n].box = box;
+            area_cost += node_cost(n);
+        }
+
+        double summed_cost() const;
+
+        void free_node(int n){
+            area_cost -= node_cost(n);
+            free_nodes.push_back(n);
+        }
+
+        int allocate_node(){
+            if(!free_nodes.empty()){
+                int n = free_nodes.back();
+                free_nodes.pop_back();
+                return n;
+            }
+            nodes.push_back(bvh_node());
+            return int(nodes.size()) - 1;
+        }
+
+        void refit_upwards(int n){
+            while(n >= 0){
+                set_box(n, surrounding_box(nodes[nodes[n].left].box, nodes[nodes[n].right].box));
+                n = nodes[n].parent;
+            }
+        }
+
+        // copy a subtree built by build_nodes into free slots, its root into target
+        void splice(const std::vector<bvh_node>& built, int built_root, int target, int parent);
+
+        static int build_range(std::pair<int, aabb>* items, int n, int parent, std::vector<bvh_node>& out);
+
+        // traversal stacks overflowing on degenerate trees continue recursively
+        static const int STACK_SIZE = 64;
+        bool intersect_from(int start, const ray& r, const vec3& inv_dir, double t_min, double& closest, hit_record& rec) const;
+        bool occluded_from(int start, const ray& r, const vec3& inv_dir, double t_min, double t_max) const;
+
+    private:
+        std::vector<int> leaf_of;
+        std::vector<int> free_ids;
+        std::vector<int> free_nodes;
+        // node_cost summed over the tree
+        double area_cost = 0.0;
+};
+
+// entry distance of a ray into a box, or INFINITY when it misses
+inline double box_entry(const aabb &box, const point3 &orig, const vec3 &inv_dir, double t_min, double t_max){
+    for(int a=0; a<3; a++){
+        auto t0 = (box.minimum[a] - orig[a]) * inv_dir[a];
+        auto t1 = (box.maximum[a] - orig[a]) * inv_dir[a];
+        if(inv_dir[a] < 0){
+            std::swap(t0, t1);
+        }
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if(t_max < t_min){
+            return INFINITY;
+        }
+    }
+    return t_min;
+}
+
+// removed objects are skipped, a scene may replay moves made before a remove
+void bvh::update(int id){
+    int leaf = leaf_of[id];
+    if(leaf < 0 || objects[id] == nullptr){
+        return;
+    }
+    aabb box;
+    objects[id]->bounding_box(box);
+    set_box(leaf, box);
+    refit_upwards(nodes[leaf].parent);
+}
+
+void bvh::insert_leaf(int id){
+    aabb box;
+    if(!objects[id]->bounding_box(box)){
+        unbounded.push_back(id);
+        return;
+    }
+
+    int leaf = allocate_node();
+    nodes[leaf] = {box, -1, -1, -1, id};
+    area_cost += node_cost(leaf);
+    leaf_of[id] = leaf;
+    if(root < 0){
+        root = leaf;
+        return;
+    }
+
+    // greedy descent towards the cheapest sibling (SAH insertion cost)
+    int n = root;
+    while(!nodes[n].leaf()){
+        double area = nodes[n].box.surface_area();
+        double combined = surrounding_box(nodes[n].box, box).surface_area();
+        double cost_here = 2 * combined;
+        double inherited = 2 * (combined - area);
+
+        double child_cost[2];
+        int children[2] = {nodes[n].left, nodes[n].right};
+        for(int c=0; c<2; c++){
+            const aabb &cb = nodes[children[c]].box;
+            double grown = surrounding_box(cb, box).surface_area();
+            child_cost[c] = nodes[children[c]].leaf() ? grown + inherited : grown - cb.surface_area() + inherited;
+        }
+
+        if(cost_here < child_cost[0] && cost_here < child_cost[1]){
+            break;
+        }
+        n = child_cost[0] < child_cost[1] ? children[0] : children[1];
+    }
+
+    int old_parent = nodes[n].parent;
+    int parent = allocate_node();
+    nodes[parent] = {surrounding_box(nodes[n].box, box), old_parent, n, leaf, -1};
+    area_cost += node_cost(parent);
+    nodes[n].parent = parent;
+    nodes[leaf].parent = parent;
+    if(old_parent < 0){
+        root = parent;
+    }
+    else if(nodes[old_parent].left == n){
+        nodes[old_parent].left = parent;
+    }
+    else{
+        nodes[old_parent].right = parent;
+    }
+    refit_upwards(old_parent);
+}
+
+void bvh::remove_leaf(int id){
+    int leaf = id < int(leaf_of.size()) ? leaf_of[id] : -1;
+    if(leaf < 0){
+        unbounded.erase(std::remove(unbounded.begin(), unbounded.end(), id), unbounded.end());
+        return;
+    }
+    leaf_of[id] = -1;
+    free_node(leaf);
+
+    int parent = nodes[leaf].parent;
+    if(parent < 0){
+        root = -1;
+        return;
+    }
+
+    int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+    int grandparent = nodes[parent].parent;
+    nodes[sibling].parent = grandparent;
+    free_node(parent);
+    if(grandparent < 0){
+        root = sibling;
+        return;
+    }
+    if(nodes[grandparent].left == parent){
+        nodes[grandparent].left = sibling;
+    }
+    else{
+        nodes[grandparent].right = sibling;
+    }
+    refit_upwards(grandparent);
+}
+
+int bvh::build_range(std::pair<int, aabb>* items, int n, int parent, std::vector<bvh_node>& out){
+    int node = int(out.size());
+    out.push_back(bvh_node());
+    if(n == 1){
+        out[node] = {items[0].second, parent, -1, -1, items[0].first};
+        return node;
+    }
+
+    aabb bounds, centroids;
+    for(int i=0; i<n; i++){
+        bounds.expand(items[i].second);
+        centroids.expand(items[i].second.centroid());
+    }
+
+    // binned SAH over the axis with the largest centroid extent
+    const int BINS = 16;
+    vec3 extent = centroids.max() - centroids.min();
+    int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    int mid = n / 2;
+
+    if(extent[axis] > 0){
+        aabb bin_box[BINS];
+        int bin_count[BINS] = {0};
+        double scale = BINS / extent[axis];
+        auto bin_of = [&](const aabb &b){
+            return std::min(BINS - 1, int((b.centroid()[axis] - centroids.min()[axis]) * scale));
+        };
+        for(int i=0; i<n; i++){
+            int b = bin_of(items[i].second);
+            bin_count[b]++;
+            bin_box[b].expand(items[i].second);
+        }
+
+        double right_area[BINS];
+        int right_count[BINS];
+        aabb acc;
+        int count = 0;
+        for(int b=BINS-1; b>0; b--){
+            acc.expand(bin_box[b]);
+            count += bin_count[b];
+            right_area[b] = acc.surface_area();
+            right_count[b] = count;
+        }
+
+        double best_cost = INFINITY;
+        int best_split = -1;
+        acc = aabb();
+        count = 0;
+        for(int b=0; b<BINS-1; b++){
+            acc.expand(bin_box[b]);
+            count += bin_count[b];
+            if(count == 0 || right_count[b+1] == 0){
+                continue;
+            }
+            double cost = count * acc.surface_area() + right_count[b+1] * right_area[b+1];
+            if(cost < best_cost){
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        if(best_split >= 0){
+            auto split = std::partition(items, items + n, [&](const std::pair<int, aabb> &it){
+                return bin_of(it.second) <= best_split;
+            });
+            mid = int(split - items);
+        }
+        else{
+            std::nth_element(items, items + mid, items + n, [axis](const std::pair<int, aabb> &a, const std::pair<int, aabb> &b){
+                return a.second.centroid()[axis] < b.second.centroid()[axis];
+            });
+        }
+    }
+
+    int left = build_range(items, mid, node, out);
+    int right = build_range(items + mid, n - mid, node, out);
+    out[node] = {bounds, parent, left, right, -1};
+    return node;
+}
+
+int bvh::build_nodes(std::vector<std::pair<int, aabb>> items, std::vector<bvh_node>& out){
+    out.clear();
+    if(items.empty()){
+        return -1;
+    }
+    out.reserve(2 * items.size());
+    return build_range(items.data(), int(items.size()), -1, out);
+}
+
+void bvh::install(std::vector<bvh_node>&& new_nodes, int new_root){
+    for(auto &l : leaf_of){
+        l = -1;
+    }
+    nodes = std::move(new_nodes);
+    free_nodes.clear();
+    root = new_root;
+    for(int n=0; n<int(nodes.size()); n++){
+        if(nodes[n].leaf()){
+            leaf_of[nodes[n].prim] = n;
+        }
+    }
+    area_cost = summed_cost();
+}
+
+void bvh::rebuild(){
+    std::vector<std::pair<int, aabb>> items;
+    unbounded.clear();
+    for(int id=0; id<int(objects.size()); id++){
+        aabb box;
+        if(!objects[id]){
+            continue;
+        }
+        if(objects[id]->bounding_box(box)){
+            items.push_back({id, box});
+        }
+        else{
+            unbounded.push_back(id);
+        }
+    }
+
+    std::vector<bvh_node> built;
+    int built_root = build_nodes(std::move(items), built);
+    install(std::move(built), built_root);
+}
+
+void bvh::splice(const std::vector<bvh_node>& built, int built_root, int target, int parent){
+    std::vector<int> map(built.size());
+    for(int i=0; i<int(built.size()); i++){
+        map[i] = i == built_root ? target : allocate_node();
+    }
+    for(int i=0; i<int(built.size()); i++){
+        bvh_node n = built[i];
+        n.parent = i == built_root ? parent : map[n.parent];
+        if(!n.leaf()){
+            n.left = map[n.left];
+            n.right = map[n.right];
+        }
+        else{
+            leaf_of[n.prim] = map[i];
+        }
+        nodes[map[i]] = n;
+        area_cost += node_cost(map[i]);
+    }
+}
+
+void bvh::rebuild_subtree(int node){
+    if(node < 0 || nodes[node].leaf()){
+        return;
+    }
+
+    std::vector<std::pair<int, aabb>> items;
+    std::vector<int> stack = {node};
+    while(!stack.empty()){
+        int n = stack.back();
+        stack.pop_back();
+        if(nodes[n].leaf()){
+            items.push_back({nodes[n].prim, nodes[n].box});
+        }
+        else{
+            stack.push_back(nodes[n].left);
+            stack.push_back(nodes[n].right);
+        }
+        if(n != node){
+            free_node(n);
+        }
+    }
+
+    std::vector<bvh_node> built;
+    int built_root = build_nodes(std::move(items), built);
+    area_cost -= node_cost(node);
+    splice(built, built_root, node, nodes[node].parent);
+}
+
+double bvh::summed_cost() const{
+    if(root < 0){
+        return 0.0;
+    }
+
+    double cost = 0.0;
+    std::vector<int> stack = {root};
+    while(!stack.empty()){
+        int n = stack.back();
+        stack.pop_back();
+        cost += node_cost(n);
+        if(!nodes[n].leaf()){
+            stack.push_back(nodes[n].left);
+            stack.push_back(nodes[n].right);
+        }
+    }
+    return cost;
+}
+
+double bvh::sah_cost_walk() const{
+    double root_area = root >= 0 ? nodes[root].box.surface_area() : 0.0;
+    return root_area > 0 ? summed_cost() / root_area : 0.0;
+}
+
+int bvh::worst_subtree(int max_leaves) const{
+    if(root < 0){
+        return -1;
+    }
+
+    // post-order pass counting leaves per subtree
+    std::vector<int> order;
+    std::vector<int> stack = {root};
+    while(!stack.empty()){
+        int n = stack.back();
+        stack.pop_back();
+        order.push_back(n);
+        if(!nodes[n].leaf()){
+            stack.push_back(nodes[n].left);
+            stack.push_back(nodes[n].right);
+        }
+    }
+
+    std::vector<int> leaves(nodes.size(), 0);
+    int worst = -1;
+    double worst_overlap = 0.0;
+    for(int i=int(order.size())-1; i>=0; i--){
+        int n = order[i];
+        if(nodes[n].leaf()){
+            leaves[n] = 1;
+            continue;
+        }
+        leaves[n] = leaves[nodes[n].left] + leaves[nodes[n].right];
+        if(leaves[n] > max_leaves){
+            continue;
+        }
+
+        const aabb &a = nodes[nodes[n].left].box;
+        const aabb &b = nodes[nodes[n].right].box;
+        aabb overlap;
+        for(int k=0; k<3; k++){
+            overlap.minimum[k] = fmax(a.minimum[k], b.minimum[k]);
+            overlap.maximum[k] = fmin(a.maximum[k], b.maximum[k]);
+        }
+        double score = overlap.surface_area() * leaves[n];
+        if(score > worst_overlap){
+            worst_overlap = score;
+            worst = n;
+        }
+    }
+    return worst;
+}
+
+bool bvh::intersect_from(int start, const ray& r, const vec3& inv_dir, double t_min, double& closest, hit_record& rec) const{
+    bool hit_anything = false;
+    point3 orig = r.origin();
+
+    // entry distances are checked again when popped, a hit found since the push
+    // may have moved closest in front of the node
+    int stack[STACK_SIZE];
+    double stack_dist[STACK_SIZE];
+    int top = 0;
+    stack[top] = start;
+    stack_dist[top++] = t_min;
+    while(top > 0){
+        top--;
+        if(stack_dist[top] > closest){
+            continue;
+        }
+        const bvh_node &n = nodes[stack[top]];
+        if(n.leaf()){
+            if(objects[n.prim]->intersect(r, t_min, closest, rec)){
+                hit_anything = true;
+                closest = rec.t;
+            }
+            continue;
+        }
+
+        // visit the nearer child first so closest shrinks early
+        double tl = box_entry(nodes[n.left].box, orig, inv_dir, t_min, closest);
+        double tr = box_entry(nodes[n.right].box, orig, inv_dir, t_min, closest);
+        int first = n.left, second = n.right;
+        if(tr < tl){
+            std::swap(tl, tr);
+            std::swap(first, second);
+        }
+        if(tr < INFINITY){
+            if(top < STACK_SIZE){
+                stack[top] = second;
+                stack_dist[top++] = tr;
+            }
+            else{
+                hit_anything |= intersect_from(second, r, inv_dir, t_min, closest, rec);
+            }
+        }
+        if(tl < INFINITY){
+            if(top < STACK_SIZE){
+                stack[top] = first;
+                stack_dist[top++] = tl;
+            }
+            else{
+                hit_anything |= intersect_from(first, r, inv_dir, t_min, closest, rec);
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+bool bvh::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    bool hit_anything = false;
+    auto closest = t_max;
+
+    if(root >= 0){
+        vec3 d = r.direction();
+        vec3 inv_dir(1/d.x(), 1/d.y(), 1/d.z());
+        if(box_entry(nodes[root].box, r.origin(), inv_dir, t_min, closest) < INFINITY){
+            hit_anything = intersect_from(root, r, inv_dir, t_min, closest, rec);
+        }
+    }
+
+    for(int id : unbounded){
+        if(objects[id]->intersect(r, t_min, closest, rec)){
+            hit_anything = true;
+            closest = rec.t;
+        }
+    }
+
+    return hit_anything;
+}
+
+bool bvh::occluded_from(int start, const ray& r, const vec3& inv_dir, double t_min, double t_max) const{
+    point3 orig = r.origin();
+
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = start;
+    while(top > 0){
+        const bvh_node &n = nodes[stack[--top]];
+        if(box_entry(n.box, orig, inv_dir, t_min, t_max) == INFINITY){
+            continue;
+        }
+        if(n.leaf()){
+            if(objects[n.prim]->occluded(r, t_min, t_max)){
+                return true;
+            }
+            continue;
+        }
+        if(top + 2 <= STACK_SIZE){
+            stack[top++] = n.right;
+            stack[top++] = n.left;
+        }
+        else if(occluded_from(n.left, r, inv_dir, t_min, t_max) || occluded_from(n.right, r, inv_dir, t_min, t_max)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool bvh::occluded(const ray& r, double t_min, double t_max) const{
+    for(int id : unbounded){
+        if(objects[id]->occluded(r, t_min, t_max)){
+            return true;
+        }
+    }
+    if(root < 0){
+        return false;
+    }
+
+    vec3 d = r.direction();
+    return occluded_from(root, r, vec3(1/d.x(), 1/d.y(), 1/d.z()), t_min, t_max);
+}
+
+bool bvh::bounding_box(aabb& output_box) const{
+    if(root < 0 || !unbounded.empty()){
+        return false;
+    }
+    output_box = nodes[root].box;
+    return true;
+}
+
+#endif
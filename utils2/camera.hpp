@@ -33,6 +33,11 @@ class camera {
             return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin);
         }
 
+        // angle one of height rows covers at the image center, the width of a primary ray's footprint
+        double pixel_spread(int height) const {
+            return vertical.length() / height;
+        }
+
         void handle_inputs(SDL_Event event){
             switch(event.type){
                 case SDL_KEYDOWN:
@@ -0,0 +1,223 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Three ARGB8888 frames shared by one render thread and the SDL thread. The
+// renderer draws into back() and publish()es it; the SDL thread acquire()s
+// the latest published frame and uploads front(). Neither side ever waits
+// for the other, a frame published twice before it is shown is replaced.
+class triple_buffer {
+    public:
+        triple_buffer(int w, int h) : width(w), height(h) {
+            for(auto &b : buffers){
+                b.assign(size_t(w) * h, 0xff000000u);
+            }
+        }
+
+        // render thread only
+        uint32_t* back(){
+            return buffers[back_index].data();
+        }
+
+        // fills a size x size block of the back buffer, clipped to the frame
+        void fill(int x, int y, int size, uint32_t value){
+            uint32_t *b = back();
+            for(int j=y; j<std::min(y + size, height); j++){
+                for(int i=x; i<std::min(x + size, width); i++){
+                    b[size_t(j) * width + i] = value;
+                }
+            }
+        }
+
+        // hands the back buffer to the presenter; keep starts the next back buffer
+        // from a copy of it, for images that are built up over several publishes
+        void publish(bool keep = false){
+            std::lock_guard<std::mutex> lock(m);
+            std::swap(back_index, ready_index);
+            fresh = true;
+            if(keep){
+                std::memcpy(buffers[back_index].data(), buffers[ready_index].data(), buffers[ready_index].size() * sizeof(uint32_t));
+            }
+        }
+
+        // SDL thread only, false when nothing new was published since the last call
+        bool acquire(){
+            std::lock_guard<std::mutex> lock(m);
+            if(!fresh){
+                return false;
+            }
+            std::swap(front_index, ready_index);
+            fresh = false;
+            return true;
+        }
+
+        // a published frame is waiting to be acquired
+        bool pending(){
+            std::lock_guard<std::mutex> lock(m);
+            return fresh;
+        }
+
+        const uint32_t* front() const {
+            return buffers[front_index].data();
+        }
+
+        int pitch() const {return width * int(sizeof(uint32_t)); }
+
+    public:
+        const int width;
+        const int height;
+
+    private:
+        std::vector<uint32_t> buffers[3];
+        int back_index = 0;
+        int ready_index = 1;
+        int front_index = 2;
+        bool fresh = false;
+        std::mutex m;
+};
+
+inline int render_thread_count(){
+    return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// Threads started once and kept for the whole process, so a parallel loop
+// costs a wake-up rather than a thread creation. run() lends the caller's
+// work to idle threads; the caller works too and only waits for the helpers
+// that actually joined in, so a loop started from inside another one (all
+// threads busy) simply runs on its caller instead of deadlocking.
+class worker_pool {
+    public:
+        worker_pool(int thread_count){
+            std::lock_guard<std::mutex> lock(m);
+            grow(thread_count);
+        }
+
+        ~worker_pool(){
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto &t : workers){
+                t.join();
+            }
+        }
+
+        // one per process, starting with as many threads as there are cores besides the caller's
+        static worker_pool& shared(){
+            static worker_pool pool(render_thread_count() - 1);
+            return pool;
+        }
+
+        // calls work() on this thread and on up to helpers idle pool threads at once;
+        // the pool starts more threads when asked for more helpers than it has
+        void run(int helpers, const std::function<void()> &work);
+
+    private:
+        struct batch {
+            const std::function<void()> *work;
+            bool closed = false;
+            int started = 0;
+            int finished = 0;
+            std::mutex m;
+            std::condition_variable done;
+        };
+
+        // called with m held
+        void grow(int thread_count){
+            while(int(workers.size()) < thread_count){
+                workers.emplace_back([this](){ serve(); });
+            }
+        }
+
+        void serve();
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::shared_ptr<batch>> queue;
+        bool stopping = false;
+        std::mutex m;
+        std::condition_variable wake;
+};
+
+void worker_pool::run(int helpers, const std::function<void()> &work){
+    auto b = std::make_shared<batch>();
+    b->work = &work;
+    if(helpers > 0){
+        {
+            std::lock_guard<std::mutex> lock(m);
+            grow(helpers);
+            for(int h=0; h<helpers; h++){
+                queue.push_back(b);
+            }
+        }
+        if(helpers == 1){
+            wake.notify_one();
+        }
+        else{
+            wake.notify_all();
+        }
+    }
+
+    work();
+
+    // helpers that have not picked the batch up yet find it closed and skip it
+    std::unique_lock<std::mutex> lock(b->m);
+    b->closed = true;
+    b->done.wait(lock, [&](){ return b->finished == b->started; });
+}
+
+void worker_pool::serve(){
+    for(;;){
+        std::shared_ptr<batch> b;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            wake.wait(lock, [&](){ return stopping || !queue.empty(); });
+            if(queue.empty()){
+                return;
+            }
+            b = std::move(queue.front());
+            queue.pop_front();
+        }
+        {
+            std::lock_guard<std::mutex> lock(b->m);
+            if(b->closed){
+                continue;
+            }
+            b->started++;
+        }
+        (*b->work)();
+        {
+            std::lock_guard<std::mutex> lock(b->m);
+            b->finished++;
+        }
+        b->done.notify_one();
+    }
+}
+
+// runs body(i) for every i in [0, count) on up to threads threads of the shared
+// pool, handing out one index at a time; the calling thread takes part and
+// returns when all are done
+template<typename F>
+void parallel_for(int count, int threads, F body){
+    std::atomic<int> next(0);
+    std::function<void()> work = [&](){
+        for(int i = next++; i < count; i = next++){
+            body(i);
+        }
+    };
+    worker_pool::shared().run(std::min(threads, count) - 1, work);
+}
+
+#endif
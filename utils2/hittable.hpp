@@ -3,9 +3,11 @@
 
 #include "vec3.hpp"
 #include "ray.hpp"
+#include "aabb.hpp"
 #include <memory>
 
 class material;
+class hittable;
 
 struct hit_record {
     point3 p;
@@ -14,6 +16,14 @@ struct hit_record {
     double t;
     bool front_face;
 
+    // filled during traversal, the rest only by finalize() of the closest primitive
+    const hittable* obj;
+    const hittable* inner;
+    // primitive within obj, for objects that hold many
+    int prim;
+    double u;
+    double v;
+
     inline void set_face_normal(const ray &r, const vec3 &n){
         front_face = dot(r.direction(), n) < 0;
         normal = front_face ? n : -n;
@@ -22,7 +32,35 @@ struct hit_record {
 
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        // closest hit in two phases: intersect() only stores t, the primitive and its
+        // surface parameters (u, v) in rec, finalize() then builds the point, normal
+        // and material for the winning primitive alone
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual void finalize(const ray& r, hit_record& rec) const {}
+
+        bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            if(!intersect(r, t_min, t_max, rec)){
+                return false;
+            }
+            rec.obj->finalize(r, rec);
+            return true;
+        }
+
+        // any-hit query for shadow/visibility rays, returns at the first intersection
+        // in (t_min, t_max) without building a hit_record
+        virtual bool occluded(const ray& r, double t_min, double t_max) const = 0;
+
+        // false for unbounded objects, which acceleration structures keep outside the tree
+        virtual bool bounding_box(aabb& output_box) const {return false;}
+
+        // rigid motion for dynamic scenes; the owning bvh has to be told to refit
+        virtual void translate(const vec3& offset) {}
+
+        // area light sampling: solid angle density of direction v as seen from o, and
+        // a (non-normalised) direction from o towards the surface point picked by the
+        // uniform samples u (u[0], u[1] position, u[2] light selection in lists)
+        virtual double pdf_value(const point3& o, const vec3& v) const {return 0.0;}
+        virtual vec3 sample_direction(const point3& o, const vec3& u) const {return vec3(1, 0, 0);}
 };
 
 #endif
\ No newline at end of file
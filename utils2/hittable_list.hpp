@@ -17,26 +17,72 @@ class hittable_list : public hittable{
         void clear() {objects.clear();}
         void add(shared_ptr<hittable> object) {objects.push_back(object);}
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 sample_direction(const point3& o, const vec3& u) const override;
 
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
-    hit_record temp_rec;
+// children only write rec when they hit inside (t_min, closest), so no copies are needed
+bool hittable_list::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
     bool hit_anything = false;
     auto closest = t_max;
 
     for(const auto &object : objects){
-        if(object->hit(r, t_min, closest, temp_rec)){
+        if(object->intersect(r, t_min, closest, rec)){
             hit_anything = true;
-            closest = temp_rec.t;
-            rec = temp_rec;
+            closest = rec.t;
         }
     }
 
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const{
+    for(const auto &object : objects){
+        if(object->occluded(r, t_min, t_max)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const{
+    output_box = aabb();
+    for(const auto &object : objects){
+        aabb box;
+        if(!object->bounding_box(box)){
+            return false;
+        }
+        output_box.expand(box);
+    }
+
+    return !objects.empty();
+}
+
+// lights are picked uniformly, so the density is the mean of the members' densities
+double hittable_list::pdf_value(const point3& o, const vec3& v) const{
+    if(objects.empty()){
+        return 0.0;
+    }
+
+    double sum = 0.0;
+    for(const auto &object : objects){
+        sum += object->pdf_value(o, v);
+    }
+
+    return sum / objects.size();
+}
+
+vec3 hittable_list::sample_direction(const point3& o, const vec3& u) const{
+    int n = int(objects.size());
+    int i = std::min(int(u[2] * n), n - 1);
+    return objects[i]->sample_direction(o, u);
+}
+
 #endif
\ No newline at end of file
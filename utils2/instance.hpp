@@ -0,0 +1,181 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.hpp"
+#include "aabb.hpp"
+#include "vec3.hpp"
+#include "ray.hpp"
+#include <memory>
+
+// affine transform as a 3x4 matrix, point' = M * point + translation
+class transform {
+    public:
+        transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+        static transform translation(const vec3 &t){
+            transform r;
+            r.m[0][3] = t.x();
+            r.m[1][3] = t.y();
+            r.m[2][3] = t.z();
+            return r;
+        }
+
+        static transform scaling(const vec3 &s){
+            transform r;
+            r.m[0][0] = s.x();
+            r.m[1][1] = s.y();
+            r.m[2][2] = s.z();
+            return r;
+        }
+
+        // rotation about a unit axis by angle in degrees (Rodrigues)
+        static transform rotation(const vec3 &axis, double degrees){
+            vec3 a = unit_vector(axis);
+            double th = degrees * M_PI / 180;
+            double c = cos(th), s = sin(th), t = 1 - c;
+            transform r;
+            r.m[0][0] = t*a.x()*a.x() + c;       r.m[0][1] = t*a.x()*a.y() - s*a.z(); r.m[0][2] = t*a.x()*a.z() + s*a.y();
+            r.m[1][0] = t*a.x()*a.y() + s*a.z(); r.m[1][1] = t*a.y()*a.y() + c;       r.m[1][2] = t*a.y()*a.z() - s*a.x();
+            r.m[2][0] = t*a.x()*a.z() - s*a.y(); r.m[2][1] = t*a.y()*a.z() + s*a.x(); r.m[2][2] = t*a.z()*a.z() + c;
+            return r;
+        }
+
+        point3 apply_point(const point3 &p) const {
+            return vec3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                        m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                        m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+        }
+
+        vec3 apply_vector(const vec3 &v) const {
+            return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                        m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                        m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+        }
+
+        // multiplies by the transpose of the linear part, used with the inverse for normals
+        vec3 apply_transposed(const vec3 &v) const {
+            return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                        m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                        m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+        }
+
+        transform inverse() const {
+            double det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                       - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                       + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+            assertm(det != 0, "Cannot invert a singular transform.");
+            double inv = 1 / det;
+
+            transform r;
+            r.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv;
+            r.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv;
+            r.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv;
+            r.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv;
+            r.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv;
+            r.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv;
+            r.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv;
+            r.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv;
+            r.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv;
+
+            vec3 t = r.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+            r.m[0][3] = -t.x();
+            r.m[1][3] = -t.y();
+            r.m[2][3] = -t.z();
+            return r;
+        }
+
+    public:
+        double m[3][4];
+};
+
+// a applied after b
+inline transform operator*(const transform &a, const transform &b){
+    transform r;
+    for(int i=0; i<3; i++){
+        for(int j=0; j<4; j++){
+            r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j] + (j == 3 ? a.m[i][3] : 0);
+        }
+    }
+    return r;
+}
+
+// Placement of shared geometry (usually a bottom-level bvh) under an affine
+// transform. Instances go into a top-level bvh, so memory stays proportional
+// to unique geometry, and moving an instance only refits the top level.
+// Rays are moved into object space without renormalising, so t is the same
+// in both spaces; instances of instances are not supported.
+class instance : public hittable {
+    public:
+        instance(std::shared_ptr<hittable> obj, const transform &t) : object(obj) {
+            set_transform(t);
+        }
+
+        void set_transform(const transform &t){
+            to_world = t;
+            to_object = t.inverse();
+            update_box();
+        }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            output_box = box;
+            return has_box;
+        }
+
+        virtual void translate(const vec3& offset) override {
+            set_transform(transform::translation(offset) * to_world);
+        }
+
+    public:
+        std::shared_ptr<hittable> object;
+        transform to_world;
+        transform to_object;
+
+    private:
+        ray local_ray(const ray &r) const {
+            return ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()));
+        }
+
+        void update_box(){
+            aabb local;
+            has_box = object->bounding_box(local);
+            box = aabb();
+            if(!has_box){
+                return;
+            }
+            for(int i=0; i<8; i++){
+                point3 corner((i & 1) ? local.max().x() : local.min().x(),
+                              (i & 2) ? local.max().y() : local.min().y(),
+                              (i & 4) ? local.max().z() : local.min().z());
+                box.expand(to_world.apply_point(corner));
+            }
+        }
+
+    private:
+        aabb box;
+        bool has_box = false;
+};
+
+bool instance::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    if(!object->intersect(local_ray(r), t_min, t_max, rec)){
+        return false;
+    }
+    rec.inner = rec.obj;
+    rec.obj = this;
+    return true;
+}
+
+void instance::finalize(const ray& r, hit_record& rec) const{
+    rec.inner->finalize(local_ray(r), rec);
+    rec.p = to_world.apply_point(rec.p);
+    rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+}
+
+bool instance::occluded(const ray& r, double t_min, double t_max) const{
+    return object->occluded(local_ray(r), t_min, t_max);
+}
+
+#endif
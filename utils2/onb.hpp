@@ -0,0 +1,39 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "vec3.hpp"
+
+// orthonormal basis with w along a given direction
+class onb {
+    public:
+        onb() {}
+        onb(const vec3 &n) {build_from_w(n);}
+
+        vec3 u() const {return axis[0]; }
+        vec3 v() const {return axis[1]; }
+        vec3 w() const {return axis[2]; }
+
+        vec3 local(double a, double b, double c) const {
+            return a*axis[0] + b*axis[1] + c*axis[2];
+        }
+
+        vec3 local(const vec3 &a) const {
+            return local(a.x(), a.y(), a.z());
+        }
+
+        // branchless construction (Duff et al. 2017)
+        void build_from_w(const vec3 &n){
+            vec3 w = unit_vector(n);
+            double sign = std::copysign(1.0, w.z());
+            double a = -1.0 / (sign + w.z());
+            double b = w.x() * w.y() * a;
+            axis[0] = vec3(1.0 + sign * w.x() * w.x() * a, sign * b, -sign * w.x());
+            axis[1] = vec3(b, sign + w.y() * w.y() * a, -w.y());
+            axis[2] = w;
+        }
+
+    public:
+        vec3 axis[3];
+};
+
+#endif
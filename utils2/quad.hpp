@@ -0,0 +1,111 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "hittable.hpp"
+#include "material.hpp"
+#include "vec3.hpp"
+#include <memory>
+
+// Parallelogram with corner q and sides u and v, one primitive where a pair
+// of triangles was needed before. The hit is found on the plane like
+// triangle, and the same projection axes give its (u, v) in [0, 1]^2, which
+// also serve as texture coordinates.
+class quad : public hittable {
+    public:
+        quad() {}
+        quad(point3 q_, vec3 u_, vec3 v_, std::shared_ptr<material> m) : q(q_), u(u_), v(v_), mat_ptr(m) {
+            vec3 n = cross(u, v);
+            normal = unit_vector(n);
+            area = n.length();
+            u_axis = cross(v, n) / n.length_squared();
+            v_axis = cross(n, u) / n.length_squared();
+        };
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void finalize(const ray& r, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void translate(const vec3& offset) override {q += offset;}
+        virtual double pdf_value(const point3& o, const vec3& dir) const override;
+        virtual vec3 sample_direction(const point3& o, const vec3& s) const override;
+
+    private:
+        bool intersect_plane(const ray& r, double t_min, double t_max, double& t, double& a, double& b) const{
+            double denom = dot(normal, r.direction());
+            if(denom == 0){
+                return false;
+            }
+            vec3 tvec = r.origin() - q;
+            t = -dot(normal, tvec) / denom;
+            if(!(t > t_min && t < t_max)){
+                return false;
+            }
+            vec3 p = tvec + t * r.direction();
+            a = dot(p, u_axis);
+            if(a < 0 || a > 1){
+                return false;
+            }
+            b = dot(p, v_axis);
+            return b >= 0 && b <= 1;
+        }
+
+    public:
+        point3 q;
+        vec3 u;
+        vec3 v;
+        vec3 normal;
+        double area;
+        vec3 u_axis;
+        vec3 v_axis;
+        std::shared_ptr<material> mat_ptr;
+};
+
+bool quad::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    double t, a, b;
+    if(!intersect_plane(r, t_min, t_max, t, a, b)){
+        return false;
+    }
+    rec.t = t;
+    rec.u = a;
+    rec.v = b;
+    rec.obj = this;
+    return true;
+}
+
+void quad::finalize(const ray& r, hit_record& rec) const{
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, normal);
+    rec.mat_ptr = mat_ptr;
+}
+
+bool quad::occluded(const ray& r, double t_min, double t_max) const{
+    double t, a, b;
+    return intersect_plane(r, t_min, t_max, t, a, b);
+}
+
+bool quad::bounding_box(aabb& output_box) const{
+    output_box = aabb();
+    output_box.expand(q);
+    output_box.expand(q + u);
+    output_box.expand(q + v);
+    output_box.expand(q + u + v);
+    return true;
+}
+
+// uniform sampling by area, converted to solid angle as seen from o
+double quad::pdf_value(const point3& o, const vec3& dir) const{
+    double t, a, b;
+    if(!intersect_plane(ray(o, dir), 0.001, INFINITY, t, a, b)){
+        return 0.0;
+    }
+
+    auto distance_squared = t*t * dir.length_squared();
+    auto cosine = fabs(dot(dir, normal)) / dir.length();
+    return distance_squared / (cosine * area);
+}
+
+vec3 quad::sample_direction(const point3& o, const vec3& s) const{
+    return q + s[0]*u + s[1]*v - o;
+}
+
+#endif
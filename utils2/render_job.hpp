@@ -0,0 +1,176 @@
+#ifndef RENDER_JOB_H
+#define RENDER_JOB_H
+
+#include "framebuffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum class job_status {completed, cancelled};
+
+struct render_progress {
+    int tiles_done;
+    int tiles_total;
+};
+
+// One image, rendered tile by tile. The callbacks capture what the frame
+// needs (a copy of the camera, the scene, the target buffer) so a job is
+// independent of whatever the caller changes after submitting it.
+struct render_job {
+    // on the job thread before the first tile, e.g. to commit scene updates
+    std::function<void()> on_start;
+    // draws the pixels in [x0, x1) x [y0, y1), called from several threads at once
+    std::function<void(int x0, int y0, int x1, int y1)> render_tile;
+    // on the job thread after the last tile, skipped for cancelled jobs
+    std::function<void()> on_complete;
+    // after every tile, on the worker that finished it
+    std::function<void(const render_progress&)> on_progress;
+};
+
+// Runs render jobs in the background on one job thread that lives as long as
+// the renderer, with the tiles spread over the shared worker_pool. Submitting
+// a job cancels the one in flight; cancellation is checked before every tile,
+// so a stale frame stops within one tile per thread. Jobs run one after
+// another, so they can share a framebuffer. submit() never blocks: a job that
+// has not started yet when the next one arrives is dropped as cancelled.
+class async_renderer {
+    public:
+        async_renderer(int w, int h, int tile = 32, int thread_count = render_thread_count())
+            : width(w), height(h), tile_size(tile), threads(thread_count) {
+            worker = std::thread([this](){ serve(); });
+        }
+
+        ~async_renderer(){
+            cancel();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+        std::shared_future<job_status> submit(render_job job);
+
+        void cancel(){
+            if(cancelled){
+                *cancelled = true;
+            }
+        }
+
+        // blocks until the last submitted job has finished or stopped, including its
+        // on_complete; a job past its last cancel check still completes
+        void wait(){
+            if(current.valid()){
+                current.wait();
+            }
+        }
+
+        // a job is still rendering or waiting for the previous one to stop
+        bool busy() const {
+            return current.valid() && current.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        }
+
+    public:
+        const int width;
+        const int height;
+        const int tile_size;
+        const int threads;
+
+    private:
+        struct queued_job {
+            render_job job;
+            std::shared_ptr<std::atomic<bool>> cancelled;
+            std::promise<job_status> status;
+        };
+
+        void serve();
+        job_status run(const render_job &job, const std::atomic<bool> &flag);
+
+    private:
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        std::shared_future<job_status> current;
+
+        std::thread worker;
+        std::unique_ptr<queued_job> pending;
+        bool stopping = false;
+        std::mutex m;
+        std::condition_variable wake;
+};
+
+std::shared_future<job_status> async_renderer::submit(render_job job){
+    cancel();
+    auto next = std::make_unique<queued_job>();
+    next->job = std::move(job);
+    next->cancelled = std::make_shared<std::atomic<bool>>(false);
+    cancelled = next->cancelled;
+    current = next->status.get_future().share();
+
+    std::unique_ptr<queued_job> replaced;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        replaced = std::move(pending);
+        pending = std::move(next);
+    }
+    wake.notify_one();
+    if(replaced){
+        replaced->status.set_value(job_status::cancelled);
+    }
+    return current;
+}
+
+void async_renderer::serve(){
+    for(;;){
+        std::unique_ptr<queued_job> next;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            wake.wait(lock, [&](){ return stopping || pending != nullptr; });
+            if(pending == nullptr){
+                return;
+            }
+            next = std::move(pending);
+        }
+        next->status.set_value(run(next->job, *next->cancelled));
+    }
+}
+
+job_status async_renderer::run(const render_job &job, const std::atomic<bool> &flag){
+    if(flag){
+        return job_status::cancelled;
+    }
+    if(job.on_start){
+        job.on_start();
+    }
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int total = tiles_x * tiles_y;
+    std::atomic<int> done(0);
+    parallel_for(total, threads, [&](int t){
+        if(flag){
+            return;
+        }
+        int x0 = (t % tiles_x) * tile_size;
+        int y0 = (t / tiles_x) * tile_size;
+        job.render_tile(x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height));
+        int d = ++done;
+        if(job.on_progress){
+            job.on_progress({d, total});
+        }
+    });
+
+    if(done < total){
+        return job_status::cancelled;
+    }
+    if(job.on_complete){
+        job.on_complete();
+    }
+    return job_status::completed;
+}
+
+#endif
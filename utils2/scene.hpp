@@ -0,0 +1,176 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include <future>
+#include <chrono>
+#include <vector>
+#include <memory>
+
+// Dynamic scene for per-frame updates: objects are added, moved and removed
+// through ids while the bvh is refit in O(changed). commit() runs once per
+// frame and watches the SAH cost against the last full build; the bvh keeps
+// that cost as a running sum, so watching it is O(1) (bench dynamic). Moderate
+// degradation rebuilds the worst subtree in place; heavy degradation starts
+// a full rebuild on a background thread. That rebuild works on a snapshot of
+// the boxes, and changes made meanwhile are replayed when it is installed.
+class scene : public hittable {
+    public:
+        scene(double partial = 1.25, double full = 1.6, int partial_leaves = 256)
+            : partial_threshold(partial), full_threshold(full), max_partial_leaves(partial_leaves) {}
+
+        int add(shared_ptr<hittable> object){
+            int id = tree.insert(object);
+            log(op_add, id);
+            return id;
+        }
+
+        void remove(int id){
+            if(tree.objects[id] == nullptr){
+                return;
+            }
+            tree.remove(id);
+            log(op_remove, id);
+        }
+
+        void move(int id, const vec3 &offset){
+            tree.objects[id]->translate(offset);
+            updated(id);
+        }
+
+        // the caller changed the object's geometry directly
+        void updated(int id){
+            tree.update(id);
+            log(op_move, id);
+        }
+
+        // full rebuild on the calling thread, e.g. after the initial scene is loaded
+        void build(){
+            tree.rebuild();
+            reference_cost = tree.sah_cost();
+        }
+
+        void commit();
+
+        // SAH cost relative to the last full build, 1 right after a rebuild
+        double quality() const {
+            return reference_cost > 0 ? tree.sah_cost() / reference_cost : 1.0;
+        }
+
+        bool rebuilding() const {return pending.valid(); }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return tree.intersect(r, t_min, t_max, rec);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return tree.occluded(r, t_min, t_max);
+        }
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            return tree.bounding_box(output_box);
+        }
+
+    public:
+        bvh tree;
+        double partial_threshold;
+        double full_threshold;
+        int max_partial_leaves;
+
+    private:
+        enum op_type {op_add, op_remove, op_move};
+
+        struct built_tree {
+            std::vector<bvh_node> nodes;
+            int root;
+        };
+
+        void log(op_type type, int id){
+            if(rebuilding()){
+                journal.push_back({type, id});
+            }
+        }
+
+        void start_rebuild();
+        void finish_rebuild();
+
+    private:
+        double reference_cost = 0.0;
+        std::future<built_tree> pending;
+        std::vector<std::pair<op_type, int>> journal;
+};
+
+void scene::start_rebuild(){
+    std::vector<std::pair<int, aabb>> items;
+    items.reserve(tree.nodes.size());
+    for(int id=0; id<int(tree.objects.size()); id++){
+        if(tree.in_tree(id)){
+            aabb box;
+            tree.objects[id]->bounding_box(box);
+            items.push_back({id, box});
+        }
+    }
+
+    journal.clear();
+    pending = std::async(std::launch::async, [items = std::move(items)]() mutable {
+        built_tree result;
+        result.root = bvh::build_nodes(std::move(items), result.nodes);
+        return result;
+    });
+}
+
+void scene::finish_rebuild(){
+    built_tree result = pending.get();
+    tree.install(std::move(result.nodes), result.root);
+
+    // replay what happened to the scene while the snapshot was being built;
+    // install() only knows the snapshot's objects, so additions are inserted again
+    for(const auto &entry : journal){
+        int id = entry.second;
+        switch(entry.first){
+            case op_add:
+                if(tree.objects[id] && !tree.in_tree(id)){
+                    aabb box;
+                    if(tree.objects[id]->bounding_box(box)){
+                        tree.insert_leaf(id);
+                    }
+                }
+                break;
+            case op_remove:
+                if(tree.in_tree(id)){
+                    tree.remove_leaf(id);
+                }
+                break;
+            case op_move:
+                tree.update(id);
+                break;
+        }
+    }
+    journal.clear();
+    reference_cost = tree.sah_cost();
+}
+
+void scene::commit(){
+    if(rebuilding()){
+        if(pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+            finish_rebuild();
+        }
+        return;
+    }
+
+    if(reference_cost <= 0){
+        reference_cost = tree.sah_cost();
+        return;
+    }
+
+    double q = quality();
+    if(q > full_threshold){
+        start_rebuild();
+    }
+    else if(q > partial_threshold){
+        tree.rebuild_subtree(tree.worst_subtree(max_partial_leaves));
+    }
+}
+
+#endif
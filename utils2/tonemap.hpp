@@ -0,0 +1,174 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "vec3.hpp"
+#include "framebuffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum class tonemap_curve {none, reinhard, aces};
+enum class display_transfer {linear, gamma2, srgb};
+
+struct tonemap_settings {
+    float exposure = 1.0f;
+    tonemap_curve curve = tonemap_curve::none;
+    // gamma2 is what set_color used to do
+    display_transfer transfer = display_transfer::gamma2;
+    bool dither = true;
+};
+
+// linear radiance kept in separate r, g, b planes, so the tonemap pass
+// reads four pixels of a channel with one load
+class accum_buffer {
+    public:
+        accum_buffer(int w, int h) : width(w), height(h), r(size_t(w) * h), g(size_t(w) * h), b(size_t(w) * h) {}
+
+        // sets a size x size block, clipped to the image
+        void fill(int x, int y, int size, const color &c){
+            for(int j=y; j<std::min(y + size, height); j++){
+                for(int i=x; i<std::min(x + size, width); i++){
+                    size_t k = size_t(j) * width + i;
+                    r[k] = float(c.x());
+                    g[k] = float(c.y());
+                    b[k] = float(c.z());
+                }
+            }
+        }
+
+    public:
+        const int width;
+        const int height;
+        std::vector<float> r;
+        std::vector<float> g;
+        std::vector<float> b;
+};
+
+// sRGB encoding in 4096 steps, in units of 8-bit codes; the steepest part of
+// the curve is the linear segment near black, under one code per step
+class srgb_lut {
+    public:
+        static const int SIZE = 4096;
+
+        srgb_lut(){
+            for(int i=0; i<SIZE; i++){
+                double x = double(i) / (SIZE - 1);
+                double e = x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1 / 2.4) - 0.055;
+                table[i] = float(255 * e);
+            }
+        }
+
+        float operator()(float x) const {
+            return table[int(x * (SIZE - 1) + 0.5f)];
+        }
+
+    public:
+        float table[SIZE];
+};
+
+inline const srgb_lut& srgb_table(){
+    static const srgb_lut lut;
+    return lut;
+}
+
+// ordered dither thresholds in [0, 1), one row of four per image row
+const float BAYER_4X4[4][4] = {
+    { 0.5f / 16,  8.5f / 16,  2.5f / 16, 10.5f / 16},
+    {12.5f / 16,  4.5f / 16, 14.5f / 16,  6.5f / 16},
+    { 3.5f / 16, 11.5f / 16,  1.5f / 16,  9.5f / 16},
+    {15.5f / 16,  7.5f / 16, 13.5f / 16,  5.5f / 16}
+};
+
+// one channel to an 8-bit code, threshold 0.5 rounds and anything else dithers
+inline uint32_t tonemap_channel(float x, float threshold, const tonemap_settings &s){
+    x *= s.exposure;
+    if(s.curve == tonemap_curve::reinhard){
+        x = x / (1 + x);
+    }
+    else if(s.curve == tonemap_curve::aces){
+        // Narkowicz's fit of the ACES reference rendering transform
+        x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    }
+    // also catches NaN
+    x = x > 0 ? std::min(x, 1.0f) : 0.0f;
+
+    float e = 255 * x;
+    if(s.transfer == display_transfer::gamma2){
+        e = 255 * sqrtf(x);
+    }
+    else if(s.transfer == display_transfer::srgb){
+        e = srgb_table()(x);
+    }
+    return uint32_t(std::min(e + threshold, 255.0f));
+}
+
+#ifdef __SSE2__
+inline __m128 tonemap_channel4(__m128 x, const tonemap_settings &s){
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_mul_ps(x, _mm_set1_ps(s.exposure));
+    if(s.curve == tonemap_curve::reinhard){
+        x = _mm_div_ps(x, _mm_add_ps(one, x));
+    }
+    else if(s.curve == tonemap_curve::aces){
+        __m128 num = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+        __m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+        x = _mm_div_ps(num, den);
+    }
+    // max returns its second operand for NaN, so NaN becomes 0
+    x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), one);
+
+    if(s.transfer == display_transfer::gamma2){
+        return _mm_mul_ps(_mm_sqrt_ps(x), _mm_set1_ps(255.0f));
+    }
+    if(s.transfer == display_transfer::srgb){
+        const srgb_lut &lut = srgb_table();
+        alignas(16) int32_t index[4];
+        _mm_store_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(srgb_lut::SIZE - 1)), _mm_set1_ps(0.5f))));
+        return _mm_setr_ps(lut.table[index[0]], lut.table[index[1]], lut.table[index[2]], lut.table[index[3]]);
+    }
+    return _mm_mul_ps(x, _mm_set1_ps(255.0f));
+}
+#endif
+
+// converts rows [y0, y1) of the accumulation buffer to ARGB8888
+inline void tonemap_rows(const accum_buffer &in, uint32_t *out, int y0, int y1, const tonemap_settings &s){
+    for(int y=y0; y<y1; y++){
+        const float *threshold = BAYER_4X4[y & 3];
+        const float *r = in.r.data() + size_t(y) * in.width;
+        const float *g = in.g.data() + size_t(y) * in.width;
+        const float *b = in.b.data() + size_t(y) * in.width;
+        uint32_t *row = out + size_t(y) * in.width;
+        int x = 0;
+#ifdef __SSE2__
+        const __m128 dither = s.dither ? _mm_loadu_ps(threshold) : _mm_set1_ps(0.5f);
+        const __m128 top = _mm_set1_ps(255.0f);
+        const __m128i alpha = _mm_set1_epi32(int32_t(0xff000000u));
+        for(; x + 4 <= in.width; x+=4){
+            __m128i cr = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(tonemap_channel4(_mm_loadu_ps(r + x), s), dither), top));
+            __m128i cg = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(tonemap_channel4(_mm_loadu_ps(g + x), s), dither), top));
+            __m128i cb = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(tonemap_channel4(_mm_loadu_ps(b + x), s), dither), top));
+            __m128i argb = _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(cr, 16)), _mm_or_si128(_mm_slli_epi32(cg, 8), cb));
+            _mm_storeu_si128((__m128i*)(row + x), argb);
+        }
+#endif
+        for(; x<in.width; x++){
+            float t = s.dither ? threshold[x & 3] : 0.5f;
+            row[x] = 0xff000000u | tonemap_channel(r[x], t, s) << 16 | tonemap_channel(g[x], t, s) << 8 | tonemap_channel(b[x], t, s);
+        }
+    }
+}
+
+// the whole image in bands of rows on several threads, out is width * height pixels
+inline void tonemap(const accum_buffer &in, uint32_t *out, const tonemap_settings &s, int threads = render_thread_count()){
+    const int BAND = 16;
+    srgb_table();
+    parallel_for((in.height + BAND - 1) / BAND, threads, [&](int band){
+        tonemap_rows(in, out, band * BAND, std::min((band + 1) * BAND, in.height), s);
+    });
+}
+
+#endif
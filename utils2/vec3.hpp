@@ -66,7 +66,7 @@ class vec3{
 
         bool near_zero(){
             const auto s = 1e-8;
-            return fabs(e[0]) < s && fabs(e[1]) && fabs(e[2]);
+            return fabs(e[0]) < s && fabs(e[1]) < s && fabs(e[2]) < s;
         }
 
     public:
@@ -77,15 +77,6 @@ vec3 random_vec(double min, double max){
     return vec3(random(min, max), random(min, max), random(min, max));
 }
 
-vec3 random_in_unit_sphere(){
-    while(true){
-        auto p = random_vec(-1, 1);
-        if(p.length_squared() <= 1){
-            return p;
-        }
-    }
-}
-
 inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
@@ -133,11 +124,92 @@ inline vec3 unit_vector(vec3 v) {
 inline vec3 normalised(vec3 v){
     assertm(v.length_squared() != 0, "Cannot normalise 0-vector.");
     double inv = 1/v.length();
-    return vec3(v.e[0]*inv, v.e[1]*inv, v.e[2]);  
+    return vec3(v.e[0]*inv, v.e[1]*inv, v.e[2]*inv);
+}
+
+// closed-form warps of uniform [0,1) samples, used with the samplers;
+// hemisphere and lobe samples are in a local frame with z along the normal
+vec3 sample_unit_vector(double u1, double u2){
+    auto z = 1 - 2*u1;
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2*M_PI*u2;
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+vec3 sample_in_unit_sphere(double u1, double u2, double u3){
+    return cbrt(u3) * sample_unit_vector(u1, u2);
+}
+
+// uniform over the hemisphere, pdf 1/(2*pi)
+vec3 sample_hemisphere(double u1, double u2){
+    auto z = u1;
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2*M_PI*u2;
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+// cosine weighted, pdf cos(theta)/pi
+vec3 sample_cosine_hemisphere(double u1, double u2){
+    auto r = sqrt(u1);
+    auto phi = 2*M_PI*u2;
+    return vec3(r*cos(phi), r*sin(phi), sqrt(fmax(0.0, 1 - u1)));
+}
+
+// GGX (Trowbridge-Reitz) microfacet normal, pdf D(m)*cos(theta_m)
+vec3 sample_ggx_normal(double alpha, double u1, double u2){
+    auto tan2_theta = alpha*alpha * u1 / (1 - u1);
+    auto cos_theta = 1 / sqrt(1 + tan2_theta);
+    auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta*cos_theta));
+    auto phi = 2*M_PI*u2;
+    return vec3(sin_theta*cos(phi), sin_theta*sin(phi), cos_theta);
+}
+
+double ggx_d(double alpha, double cos_theta){
+    auto a2 = alpha*alpha;
+    auto d = cos_theta*cos_theta * (a2 - 1) + 1;
+    return a2 / (M_PI * d*d);
+}
+
+// Smith masking term for one direction
+double ggx_g1(double alpha, double cos_theta){
+    auto c2 = cos_theta*cos_theta;
+    return 2 / (1 + sqrt(1 + alpha*alpha * (1 - c2) / c2));
+}
+
+// branch-free structure-of-arrays variants for n samples at once
+void sample_unit_vector_batch(const double* u1, const double* u2, double* x, double* y, double* z, int n){
+    #pragma GCC ivdep
+    for(int i=0; i<n; i++){
+        auto zi = 1 - 2*u1[i];
+        auto r = sqrt(fmax(0.0, 1 - zi*zi));
+        auto phi = 2*M_PI*u2[i];
+        x[i] = r*cos(phi);
+        y[i] = r*sin(phi);
+        z[i] = zi;
+    }
+}
+
+void sample_cosine_hemisphere_batch(const double* u1, const double* u2, double* x, double* y, double* z, int n){
+    #pragma GCC ivdep
+    for(int i=0; i<n; i++){
+        auto r = sqrt(u1[i]);
+        auto phi = 2*M_PI*u2[i];
+        x[i] = r*cos(phi);
+        y[i] = r*sin(phi);
+        z[i] = sqrt(fmax(0.0, 1 - u1[i]));
+    }
+}
+
+vec3 random_in_unit_sphere(){
+    return sample_in_unit_sphere(random_double(), random_double(), random_double());
 }
 
 vec3 random_unit_vector(){
-    return normalised(random_in_unit_sphere());
+    return sample_unit_vector(random_double(), random_double());
+}
+
+vec3 random_cosine_direction(){
+    return sample_cosine_hemisphere(random_double(), random_double());
 }
 
 vec3 reflect(const vec3 &v, const vec3 &n){
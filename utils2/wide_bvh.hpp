@@ -0,0 +1,357 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "hittable.hpp"
+#include "bvh.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 4-wide node in one cache line. Child boxes are stored as 8-bit offsets from
+// the node origin in units of 2^exponent per axis, rounded outwards so the
+// decoded boxes are conservative. Children >= 0 are node indices; leaves hold
+// ~object_id.
+struct alignas(64) bvh4_node {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t count;
+    uint8_t qlo[3][4];
+    uint8_t qhi[3][4];
+    int32_t child[4];
+};
+
+static_assert(sizeof(bvh4_node) == 64, "bvh4_node should fill one cache line");
+
+// BVH4 collapsed from a binary bvh, with the four child boxes of a node
+// tested together in SSE and the hit children visited nearest first.
+// It is static: rebuild it from the binary tree after the scene changes.
+class wide_bvh : public hittable {
+    public:
+        wide_bvh(const bvh &source) : objects(source.objects), unbounded(source.unbounded) {
+            if(source.root >= 0){
+                root_box = source.nodes[source.root].box;
+                collapse_nodes(source.nodes, source.root, nodes);
+            }
+        }
+
+        virtual bool intersect(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            if(nodes.empty() || !unbounded.empty()){
+                return false;
+            }
+            output_box = root_box;
+            return true;
+        }
+
+    public:
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<int> unbounded;
+        std::vector<bvh4_node> nodes;
+
+        // the 4-wide tree over binary nodes made by bvh::build_nodes, its root at
+        // out[0]; leaves keep the prim of their binary leaf as ~prim
+        static void collapse_nodes(const std::vector<bvh_node> &source, int root, std::vector<bvh4_node> &out){
+            out.clear();
+            if(root < 0){
+                return;
+            }
+            if(source[root].leaf()){
+                // a lone object still needs a node around it
+                out.push_back(bvh4_node());
+                encode(source, 0, root, {root}, out);
+            }
+            else{
+                collapse(source, root, out);
+            }
+        }
+
+        struct ray4 {
+            float org[3];
+            float inv[3];
+            // the near plane of an axis is the upper one
+            bool neg[3];
+        };
+
+        static ray4 make_ray4(const ray &r){
+            ray4 r4;
+            for(int a=0; a<3; a++){
+                r4.org[a] = float(r.origin()[a]);
+                r4.inv[a] = float(1 / r.direction()[a]);
+                r4.neg[a] = r4.inv[a] < 0;
+            }
+            return r4;
+        }
+
+        // 2^e for the node exponents, which stay in the normal float range; built
+        // from the bits because ldexp is a library call in the innermost loop
+        static float scale_of(int e){
+            uint32_t bits = uint32_t(e + 127) << 23;
+            float f;
+            std::memcpy(&f, &bits, 4);
+            return f;
+        }
+
+        // bit mask of children hit inside [t_min, t_max], entry distances in dist
+        static int intersect_node(const bvh4_node &n, const ray4 &r, float t_min, float t_max, float dist[4]);
+
+    private:
+        // open the largest internal child until there are four
+        static int collapse(const std::vector<bvh_node> &source, int n, std::vector<bvh4_node> &out){
+            std::vector<int> children = {source[n].left, source[n].right};
+            while(children.size() < 4){
+                int best = -1;
+                double best_area = -1;
+                for(int i=0; i<int(children.size()); i++){
+                    const bvh_node &c = source[children[i]];
+                    if(!c.leaf() && c.box.surface_area() > best_area){
+                        best_area = c.box.surface_area();
+                        best = i;
+                    }
+                }
+                if(best < 0){
+                    break;
+                }
+                int opened = children[best];
+                children[best] = source[opened].left;
+                children.push_back(source[opened].right);
+            }
+
+            int index = int(out.size());
+            out.push_back(bvh4_node());
+            encode(source, index, n, children, out);
+            return index;
+        }
+
+        static void encode(const std::vector<bvh_node> &source, int index, int n, const std::vector<int> &children, std::vector<bvh4_node> &out){
+            bvh4_node node;
+            std::memset(&node, 0, sizeof(node));
+            const aabb &box = source[n].box;
+            node.count = uint8_t(children.size());
+
+            for(int a=0; a<3; a++){
+                float origin = float(box.min()[a]);
+                if(double(origin) > box.min()[a]){
+                    origin = std::nextafter(origin, -INFINITY);
+                }
+                double extent = box.max()[a] - origin;
+                int e = extent > 0 ? int(ceil(log2(extent / 255))) : -126;
+                e = std::max(e, -126);
+                while(ceil((box.max()[a] - origin) / ldexp(1.0, e)) > 255){
+                    e++;
+                }
+                node.origin[a] = origin;
+                node.exponent[a] = int8_t(std::min(e, 127));
+            }
+
+            for(int c=0; c<int(children.size()); c++){
+                const bvh_node &child = source[children[c]];
+                for(int a=0; a<3; a++){
+                    double scale = ldexp(1.0, node.exponent[a]);
+                    double lo = floor((child.box.min()[a] - node.origin[a]) / scale);
+                    double hi = ceil((child.box.max()[a] - node.origin[a]) / scale);
+                    node.qlo[a][c] = uint8_t(std::clamp(lo, 0.0, 255.0));
+                    node.qhi[a][c] = uint8_t(std::clamp(hi, 0.0, 255.0));
+                }
+                node.child[c] = child.leaf() ? ~child.prim : 0;
+            }
+            out[index] = node;
+
+            // recurse after storing, out may reallocate
+            for(int c=0; c<int(children.size()); c++){
+                const bvh_node &child = source[children[c]];
+                if(!child.leaf()){
+                    int k = collapse(source, children[c], out);
+                    out[index].child[c] = k;
+                }
+            }
+        }
+
+        bool intersect_from(int start, const ray& r, const ray4& r4, double t_min, double& closest, hit_record& rec) const;
+        bool occluded_from(int start, const ray& r, const ray4& r4, double t_min, double t_max) const;
+
+        static const int STACK_SIZE = 128;
+
+    private:
+        aabb root_box;
+};
+
+int wide_bvh::intersect_node(const bvh4_node &n, const ray4 &r, float t_min, float t_max, float dist[4]){
+    // float rounding in decoding and slab tests is covered by widening t_max (Ize 2013)
+    const float widen = 1.0000004f;
+#ifdef __SSE2__
+    __m128 tnear = _mm_set1_ps(t_min);
+    __m128 tfar = _mm_set1_ps(t_max);
+    const __m128i zero = _mm_setzero_si128();
+    for(int a=0; a<3; a++){
+        // the near plane is picked by the sign of the direction, like aabb::hit, so
+        // a ray lying on a plane (0 * inf = NaN) only makes that one plane NaN
+        const uint8_t *qnear = r.neg[a] ? n.qhi[a] : n.qlo[a];
+        const uint8_t *qfar = r.neg[a] ? n.qlo[a] : n.qhi[a];
+        int32_t near_bits, far_bits;
+        std::memcpy(&near_bits, qnear, 4);
+        std::memcpy(&far_bits, qfar, 4);
+        __m128 qn = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(near_bits), zero), zero));
+        __m128 qf = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(far_bits), zero), zero));
+
+        __m128 scale = _mm_set1_ps(scale_of(n.exponent[a]));
+        __m128 origin = _mm_set1_ps(n.origin[a] - r.org[a]);
+        __m128 inv = _mm_set1_ps(r.inv[a]);
+        __m128 t0 = _mm_mul_ps(_mm_add_ps(origin, _mm_mul_ps(qn, scale)), inv);
+        __m128 t1 = _mm_mul_ps(_mm_add_ps(origin, _mm_mul_ps(qf, scale)), inv);
+        // max and min return the second operand when either is NaN, which keeps the bound
+        tnear = _mm_max_ps(t0, tnear);
+        tfar = _mm_min_ps(t1, tfar);
+    }
+    tfar = _mm_mul_ps(tfar, _mm_set1_ps(widen));
+    _mm_storeu_ps(dist, tnear);
+    return _mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) & ((1 << n.count) - 1);
+#else
+    int mask = 0;
+    for(int c=0; c<n.count; c++){
+        float tn = t_min, tf = t_max;
+        for(int a=0; a<3; a++){
+            float scale = scale_of(n.exponent[a]);
+            float t0 = (n.origin[a] - r.org[a] + n.qlo[a][c] * scale) * r.inv[a];
+            float t1 = (n.origin[a] - r.org[a] + n.qhi[a][c] * scale) * r.inv[a];
+            if(r.neg[a]){
+                std::swap(t0, t1);
+            }
+            // comparisons with NaN are false, so a NaN plane leaves the bound alone
+            tn = t0 > tn ? t0 : tn;
+            tf = t1 < tf ? t1 : tf;
+        }
+        dist[c] = tn;
+        if(tn <= tf * widen){
+            mask |= 1 << c;
+        }
+    }
+    return mask;
+#endif
+}
+
+bool wide_bvh::intersect_from(int start, const ray& r, const ray4& r4, double t_min, double& closest, hit_record& rec) const{
+    bool hit_anything = false;
+    int stack[STACK_SIZE];
+    float stack_dist[STACK_SIZE];
+    int top = 0;
+    stack[top] = start;
+    stack_dist[top++] = float(t_min);
+
+    while(top > 0){
+        top--;
+        int entry = stack[top];
+        if(stack_dist[top] > float(closest) * 1.0000004f){
+            continue;
+        }
+        if(entry < 0){
+            if(objects[~entry]->intersect(r, t_min, closest, rec)){
+                hit_anything = true;
+                closest = rec.t;
+            }
+            continue;
+        }
+
+        const bvh4_node &n = nodes[entry];
+        float dist[4];
+        int mask = intersect_node(n, r4, float(t_min), float(closest), dist);
+
+        // insertion sort, farthest first on the stack so the nearest pops next
+        int order[4];
+        int k = 0;
+        for(int c=0; c<4; c++){
+            if(mask & (1 << c)){
+                int j = k++;
+                while(j > 0 && dist[order[j-1]] < dist[c]){
+                    order[j] = order[j-1];
+                    j--;
+                }
+                order[j] = c;
+            }
+        }
+        for(int i=0; i<k; i++){
+            int c = order[i];
+            if(top < STACK_SIZE){
+                stack[top] = n.child[c];
+                stack_dist[top++] = dist[c];
+            }
+            else if(n.child[c] < 0){
+                if(objects[~n.child[c]]->intersect(r, t_min, closest, rec)){
+                    hit_anything = true;
+                    closest = rec.t;
+                }
+            }
+            else{
+                hit_anything |= intersect_from(n.child[c], r, r4, t_min, closest, rec);
+            }
+        }
+    }
+
+    return hit_anything;
+}
+
+bool wide_bvh::intersect(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    bool hit_anything = false;
+    auto closest = t_max;
+
+    if(!nodes.empty()){
+        hit_anything = intersect_from(0, r, make_ray4(r), t_min, closest, rec);
+    }
+    for(int id : unbounded){
+        if(objects[id]->intersect(r, t_min, closest, rec)){
+            hit_anything = true;
+            closest = rec.t;
+        }
+    }
+
+    return hit_anything;
+}
+
+bool wide_bvh::occluded_from(int start, const ray& r, const ray4& r4, double t_min, double t_max) const{
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = start;
+
+    while(top > 0){
+        int entry = stack[--top];
+        if(entry < 0){
+            if(objects[~entry]->occluded(r, t_min, t_max)){
+                return true;
+            }
+            continue;
+        }
+
+        const bvh4_node &n = nodes[entry];
+        float dist[4];
+        int mask = intersect_node(n, r4, float(t_min), float(t_max), dist);
+        for(int c=0; c<4; c++){
+            if(!(mask & (1 << c))){
+                continue;
+            }
+            if(top < STACK_SIZE){
+                stack[top++] = n.child[c];
+            }
+            else if(n.child[c] < 0 ? objects[~n.child[c]]->occluded(r, t_min, t_max) : occluded_from(n.child[c], r, r4, t_min, t_max)){
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool wide_bvh::occluded(const ray& r, double t_min, double t_max) const{
+    for(int id : unbounded){
+        if(objects[id]->occluded(r, t_min, t_max)){
+            return true;
+        }
+    }
+    return !nodes.empty() && occluded_from(0, r, make_ray4(r), t_min, t_max);
+}
+
+#endif